@@ -3,10 +3,16 @@
 
 #include <IPBusIO/IPBusConnection.hh>
 #include <IPBusStatus/IPBusStatus.hh>
+#include <ApolloSM/svfstats.hh>
 #include <BUException/ExceptionBase.hh>
 
 
 #include <iostream>
+#include <vector>
+#include <utility>
+#include <string>
+#include <map>
+#include <unordered_map>
 
 namespace BUException{
   ExceptionClassGenerator(APOLLO_SM_BAD_VALUE,"Bad value use in Apollo SM code\n");
@@ -31,15 +37,103 @@ public:
 
   std::string UART_CMD(std::string const & ttyDev, std::string sendline, char const promptChar = '%');
 
-  int svfplayer(std::string const & svfFile, std::string const & XVCReg);
+  //batchWords > 1 sends each JTAG word in one dispatch, or batchWords of them with
+  //pollReads = 0 for a core that buffers words (see SVFPlayer::SetBatch)
+  //stats, if given, is filled with the counters and timings of the playback
+  int svfplayer(std::string const & svfFile, std::string const & XVCReg,
+		size_t batchWords = 1, size_t pollReads = 1,
+		SVFStats * stats = NULL,
+		SVFProgressCallback progress = NULL, void * progressData = NULL);
+  //Plays each (SVF file, XVC device) pair on its own thread, returns 0 if every chain ran cleanly
+  int svfplayer(std::vector<std::pair<std::string,std::string> > const & chains,
+		size_t batchWords = 1, size_t pollReads = 1,
+		std::vector<SVFStats> * stats = NULL);
+  //Writes the compiled JTAG program of an SVF file, svfplayer plays either
+  int svfcompile(std::string const & svfFile, std::string const & programFile);
+  //svfplayer keeps compiled programs of the SVF files it plays in cacheDir ("" to disable)
+  void SetSVFCache(std::string const & cacheDir);
+  //svfplayer parses and does bus I/O on separate threads with ringWords words between them (0 to disable)
+  void SetSVFPipeline(size_t ringWords);
+  //svfplayer sleeps on the interrupt of uioDevice instead of spinning on GO once a
+  //wait runs past about spinUsecs ("" to disable). Single chain playback only.
+  void SetSVFIRQ(std::string const & uioDevice, uint32_t spinUsecs);
+  //svfplayer plays into the register file of a jtagSim core instead of the bus ("" to disable).
+  //Single chain playback only.
+  void SetSVFMock(std::string const & regFile);
   
+  //On a local (uioaxi) connection, serves RegReadRegister/RegWriteRegister with loads and
+  //stores on the mmapped UIO devices instead of uHAL transactions. Each register is resolved
+  //to its address and mask on first use. Remote connections and registers that aren't
+  //single words in a UIO map keep going through uHAL. Call after Connect().
+  //Returns false if the connection isn't local.
+  bool EnableDirectIO(bool enable = true);
+  uint32_t RegReadRegister(std::string const & reg);
+  void RegWriteRegister(std::string const & reg, uint32_t value);
+  //A register looked up once, for callers that read or write it over and over
+  class RegisterHandle;
+  RegisterHandle GetRegisterHandle(std::string const & reg);
+
   bool PowerUpCM(int CM_ID,int wait = -1);
   bool PowerDownCM(int CM_ID,int wait = -1);
 
-  void DebugDump(std::ostream & output = std::cout);
+  //Reads every register twice, a second apart, and prints both. The raw
+  //snapshots also go to binaryFile if one is given (see registerSnapshot.hh)
+  void DebugDump(std::ostream & output = std::cout, std::string const & binaryFile = "");
+  //Takes snapshots readings interval seconds apart and prints only the registers that
+  //changed, with how often and their runs of values. binaryFile gets the same registers.
+  void DebugDumpDelta(std::ostream & output, size_t snapshots, double interval,
+		      std::string const & binaryFile = "");
 
 private:  
   IPBusStatus * statusDisplay;
+  std::string svfCacheDir;
+  size_t svfPipelineWords;
+  std::string svfIRQDevice;
+  uint32_t svfIRQSpin;
+  std::string svfMockFile;
+
+  /* direct UIO register access, see ApolloSM_direct.cc */
+  struct directReg {
+    uint32_t volatile * addr; //NULL goes through uHAL
+    uint32_t mask;
+    int shift;
+    bool readable;
+    bool writable;
+  };
+  struct directMap {
+    uint32_t volatile * base; //NULL if the device couldn't be mapped
+    size_t size;
+    uint32_t nodeAddr;        //uHAL address of the top level node
+  };
+  directReg const & directResolve(std::string const & reg);
+  uint32_t directRead(directReg const & direct);
+  bool directWrite(directReg const & direct, uint32_t value);
+  directMap const & directMapOf(std::string const & top);
+  void directRelease();
+  bool directIO;
+  uint64_t directGeneration; //bumped whenever the resolved registers are dropped
+  std::unordered_map<std::string, directReg> directRegs;
+  std::map<std::string, directMap> directMaps;
+};
+
+//The node of a register and, with direct IO, its UIO address and mask, so Read
+//and Write skip the name lookup. Valid as long as the ApolloSM stays connected.
+class ApolloSM::RegisterHandle {
+public:
+  RegisterHandle();
+  uint32_t Read() const;
+  template<class T> T Read() const {return static_cast<T>(Read());}
+  void Write(uint32_t value) const;
+  std::string const & Name() const {return name;}
+  bool IsValid() const {return sm != NULL;}
+private:
+  friend class ApolloSM;
+  directReg const * resolve() const;
+  ApolloSM * sm;
+  uhal::Node const * node;
+  std::string name;
+  mutable directReg const * direct;
+  mutable uint64_t directGeneration;
 };
 
 
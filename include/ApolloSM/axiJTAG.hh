@@ -0,0 +1,27 @@
+#ifndef __AXIJTAG_HH__
+#define __AXIJTAG_HH__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+//Register block of the AXI JTAG core (XAPP1251 debug bridge), the same layout
+//xvcServer maps from the UIO device and the uHAL nodes LENGTH, TMS_VECTOR,
+//TDI_VECTOR, TDO_VECTOR and GO address
+struct axi_jtag_regs {
+  uint32_t length;  //bits in the next shift, 1-32
+  uint32_t tms;     //LSB is shifted first
+  uint32_t tdi;
+  uint32_t tdo;
+  uint32_t ctrl;    //write 1 to shift, reads 1 until the shift is done
+};
+
+//Size of a register file
+#define AXI_JTAG_MAP_SIZE 0x1000
+
+//Maps a register block kept in a shared memory file, for running without the
+//hardware.  Whatever serves the file (jtagSim) plays the core.  NULL on failure
+axi_jtag_regs volatile * axi_jtag_map_file(std::string const & regFile);
+void axi_jtag_unmap_file(axi_jtag_regs volatile * regs);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __REGISTER_SNAPSHOT_HH__
+#define __REGISTER_SNAPSHOT_HH__
+
+#include <uhal/uhal.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* snapshot file, see registerSnapshot.cc */
+#define REGISTER_SNAPSHOT_VERSION 1
+struct register_snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t registers;
+  uint64_t snapshots;
+  uint64_t names_size;  //bytes of NUL terminated names after the header
+};
+
+//Reads a fixed set of registers as quickly as the connection allows.  The
+//registers are resolved once, the ones sharing an address are read once and
+//runs of consecutive addresses are read as one block, all in one dispatch.
+class RegisterSnapshot {
+public:
+  enum {
+    READ_OK    = 0,
+    BUS_ERROR  = 1,
+    WRITE_ONLY = 2
+  };
+  RegisterSnapshot(uhal::HwInterface * const * _hw);
+  //Resolves the registers, returns how many can be read
+  size_t Build(std::vector<std::string> const & registers);
+  //Fills values and status (READ_OK, ...) of every register, in Build() order
+  void Take(uint32_t * values, uint8_t * status);
+  size_t Size() const {return names.size();}
+  size_t Blocks() const {return blocks.size();}
+  std::vector<std::string> const & Names() const {return names;}
+  uint32_t Address(size_t iReg) const {return regs[iReg].addr;}
+  uint32_t Mask(size_t iReg) const {return regs[iReg].mask;}
+  //Writes snapshots taken with Take(), nSnapshots x Size() values and status
+  //after each other, and the time of each one.  With subset only those
+  //registers are written and values and status hold nSnapshots x subset->size().
+  int Save(std::string const & fileName, size_t nSnapshots,
+	   uint32_t const * values, uint8_t const * status, uint64_t const * times_ns,
+	   std::vector<size_t> const * subset = NULL) const;
+
+private:
+  RegisterSnapshot();
+  void read_words_one_by_one();
+
+  struct reg_entry {
+    size_t word;   //index into word_addrs
+    uint32_t addr;
+    uint32_t mask;
+    int shift;
+    bool readable;
+  };
+  struct word_block {
+    size_t first;  //index into word_addrs
+    uint32_t size;
+  };
+  uhal::HwInterface * const * hw;
+  std::vector<std::string> names;
+  std::vector<reg_entry> regs;
+  std::vector<uint32_t> word_addrs;   //distinct readable addresses, sorted
+  std::vector<uint32_t> word_values;
+  std::vector<uint8_t> word_status;
+  std::vector<word_block> blocks;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __SPSC_RING_HH__
+#define __SPSC_RING_HH__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+//CLOCK_MONOTONIC in ns
+inline uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Head and tail of a single producer single consumer ring.  The entries are
+ * the user's, a power of two of them indexed with head/tail & (size - 1).
+ *
+ * head is only written by the producer and tail only by the consumer, each
+ * publishes its entries with a release store.  A side that has to wait on
+ * the other spins for a short while, then sleeps on cv after raising its
+ * waiting flag; the other side only takes mutex to wake it when it sees that
+ * flag, so a ring nobody waits on costs no locking.
+ */
+class spsc_ring {
+public:
+  std::atomic<size_t> head;  //written by the producer
+  char pad[64];              //keeps head and tail on separate cache lines
+  std::atomic<size_t> tail;  //written by the consumer
+
+  spsc_ring() {Reset();}
+  //Empties the ring, neither side may be using it
+  void Reset() {
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    producer_waiting.store(false);
+    consumer_waiting.store(false);
+  }
+  //Wait until ready() is true
+  template <class Ready> void ProducerWait(Ready ready) {wait(producer_waiting, ready);}
+  template <class Ready> void ConsumerWait(Ready ready) {wait(consumer_waiting, ready);}
+  //Wake the other side if it sleeps in its wait, after publishing what it waits for
+  void WakeProducer() {wake(producer_waiting);}
+  void WakeConsumer() {wake(consumer_waiting);}
+
+private:
+  //yields before a wait goes to sleep, about the time of a few bus transactions
+  static const int spins = 64;
+
+  template <class Ready> void wait(std::atomic<bool> & waiting, Ready ready) {
+    for (int spin = 0; spin < spins; spin++) {
+      if (ready()) {
+	return;
+      }
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    waiting.store(true);
+    //pairs with the fence in wake, one of the two sides sees the other
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!ready()) {
+      //the timeout only covers a wake that was missed anyway
+      cv.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    waiting.store(false);
+  }
+  void wake(std::atomic<bool> & waiting) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(mutex);
+      cv.notify_all();
+    }
+  }
+
+  std::mutex mutex;          //only for sleeping in wait()
+  std::condition_variable cv;
+  std::atomic<bool> producer_waiting;
+  std::atomic<bool> consumer_waiting;
+};
+
+#endif
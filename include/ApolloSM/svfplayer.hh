@@ -5,50 +5,194 @@
 #include <IPBusStatus/IPBusStatus.hh>
 #include <BUException/ExceptionBase.hh>
 #include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/axiJTAG.hh>
+#include <ApolloSM/svfstats.hh>
+#include <ApolloSM/uioIRQ.hh>
+#include <ApolloSM/spscRing.hh>
 #include <stdio.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+
+/* compiled SVF program, see svfplayer_program.cc */
+#define SVF_PROGRAM_VERSION 2
+enum svf_program_op {
+  SVF_OP_END = 0,
+  SVF_OP_SHIFT = 1,
+  SVF_OP_SHIFT_TDO = 2,
+  SVF_OP_DELAY = 3
+};
+struct svf_program_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t source_hash; //hash of the SVF text
+  uint64_t source_size;
+  uint64_t tck_count;
+  uint64_t tdi_bits;
+  uint64_t op_words;    //uint32_t op words after the header
+};
 
 class SVFPlayer : public IPBusIO {
 public:
   SVFPlayer(uhal::HwInterface * const * _hw);  
+  ~SVFPlayer();
   int play(std::string const & svfFile , std::string const & XVCReg);
+  //Sends the bus transactions of a word in one dispatch.  pollReads GO reads
+  //(and the TDO read) go in the same dispatch and the core is polled until it
+  //is done before the next word.  pollReads = 0 is for a core that buffers
+  //words written while it is busy, then up to words words share a dispatch.
+  void SetBatch(size_t words, size_t pollReads);
+  //Converts an SVF file to a compiled program that play() runs without parsing
+  int compile(std::string const & svfFile, std::string const & programFile);
+  //Directory of compiled programs keyed by the SVF content, empty disables it
+  void SetCache(std::string const & cacheDir);
+  //Plays into a register block in a shared memory file instead of the XVCReg
+  //nodes, "" goes back to the bus.  For running without the hardware, batching
+  //does not apply to it.
+  int SetMock(std::string const & regFile);
+  //Players on other chains of the same bus share busMutex so their queued
+  //transactions never end up in each other's dispatch.  It is held for one
+  //transaction or dispatch at a time, never while a core shifts.
+  void SetBusMutex(std::mutex * busMutex);
+  //Safe to call from another thread while play() runs
+  double Progress() const;
+  uint64_t TCKs() const;
+  //Counters and timings of the last play()
+  SVFStats Stats() const;
+  //Calls progress with the current stats every interval seconds while playing,
+  //on the pipeline's I/O thread if there is one
+  void SetProgressCallback(SVFProgressCallback progress, void * data, double interval = 1.0);
+  //Parses on the calling thread and does the bus I/O on a second one, with up to
+  //ringWords packed words between them. 0 (the default) keeps it all on one thread.
+  void SetPipeline(size_t ringWords);
+  //Sleeps on the interrupt of uioDevice (the UIO device of the AXI JTAG core) when
+  //GO stays set for longer than about spinUsecs. "" goes back to spinning.
+  int SetIRQ(std::string const & uioDevice, uint32_t spinUsecs);
 private:
+  //svfBench switches per_bit
+  friend class SVFPlayerBench;
 
   SVFPlayer();
 
   /* Defined in svfplayer.cc */
   int setup(std::string const & XVCReg);
+  void reset_words();
   int shutdown();
   void udelay(long usecs, int tms, long num_tck);
-  int getbyte();
+  int map_file(std::string const & svfFile);
+  void unmap_file();
   int sync();
   int pulse_tck(int tms, int tdi, int tdo, int rmask, int sync);
   void pulse_sck();
   void set_trst(int v);
   int set_frequency(int v);
   void tck();
+  void shift_word(uint32_t tms, uint32_t tdi, uint32_t tdo, uint32_t tdoMask, int nbits);
+  void flush();
+  void flush_partial();
+  struct jtag_word;
+  void send_word(jtag_word const & word);
+  void send_word_direct(jtag_word const & word);
+  void add_tdo_scan(uint64_t firstTCK, int len, int command);
+  void wait_delay(uint64_t usecs);
+  void load_word(int length, uint32_t tms, uint32_t tdi, uint32_t tdo, uint32_t tdoMask);
+  void dispatch_words();
+  void wait_go();
+  std::unique_lock<std::mutex> bus_lock();
+  void check_tdo(uint32_t tdo, uint32_t expected, uint32_t mask, uint64_t firstTCK);
+  void retire_tdo_scans();
+  uint64_t shifted_tcks();
   
   /* defined in svfplayer_svf.cc */
-  int read_command(char **buffer_p, int *len_p);
+  int read_command(const char **command_p);
   int token2tapstate(const char *str1);
-  void bitdata_free(struct bitdata_s *bd, int offset);
+  void bitdata_free(struct bitdata_s *bd);
+  const char * hex_parse(const char *p, uint32_t *words, int nwords);
   const char * bitdata_parse(const char *p, struct bitdata_s *bd, int offset);
-  int getbit(unsigned char *data, int n);
   int bitdata_play(struct bitdata_s *bd, enum libxsvf_tap_state estate);
   int svf_reader();
 
+  /* defined in svfplayer_program.cc */
+  void record_start();
+  void record_word(int length, uint32_t tms, uint32_t tdi, uint32_t tdo, uint32_t tdoMask);
+  void record_delay(long usecs);
+  void record_stop();
+  int record_save(std::string const & programFile, uint64_t sourceHash, uint64_t sourceSize);
+  int run_program(const svf_program_header *header);
+  int play_svf();
+  const svf_program_header * mapped_program();
+
+  /* defined in svfplayer_pipeline.cc */
+  void pipeline_start();
+  void ring_push(jtag_word const & word);
+  void io_loop();
+  void pipeline_drain();
+  void pipeline_stop();
+  void pipeline_abort();
+
   /* defined in svfplayer_tap.cc */
-  void tap_transition(int v);
   int tap_walk(enum libxsvf_tap_state s);
 
   /* internal variables */
   enum libxsvf_tap_state tap_state;
-  FILE *f;
+  /* AXI word being built */
+  uint32_t tms32, tdi32, length32, tdo32, mask32;
+  int tmsval, tdival, indx;
+  /* mapped SVF file */
+  const char *svf_data;
+  const char *svf_next; //start of the next command
+  size_t svf_size;
+  size_t svf_map_size;
+  struct hex_run {
+    const char *start;
+    int len;
+  };
+  std::vector<hex_run> hex_runs;
   int verbose;
+  bool per_bit; //one pulse_tck() per TCK as before the word engine, only for svfBench
   int clockcount;
-  int bitcount_tdi;
-  int bitcount_tdo;
+  std::atomic<uint64_t> bitcount_tdi;
+  uint64_t bitcount_tdo;
   int retval_i;
   int retval[256];
+  int command_count;
+  /* bit buffers of the scans, reused from command to command */
+  struct bit_buffer_s {
+    uint32_t *data;
+    size_t words;
+  };
+  bit_buffer_s bit_buffers[LIBXSVF_MEM_NUM];
+  uint32_t * bit_buffer(enum libxsvf_mem which, int nwords);
+  void bit_buffers_free();
+
+  /* progress, read by other threads */
+  std::atomic<size_t> progress_bytes;
+  std::atomic<size_t> progress_total;
+  std::atomic<uint64_t> progress_tcks;
+
+  /* statistics */
+  void reset_stats();
+  void report_progress();
+  bool parse_pause();
+  void parse_resume(bool paused);
+  SVFStats stats;
+  uint64_t start_ns;
+  uint64_t stop_ns;
+  uint64_t bus_ns;
+  uint64_t poll_ns;
+  uint64_t delay_ns;
+  std::atomic<uint64_t> parse_ns; //time the parsing thread spent parsing
+  uint64_t parse_mark;
+  bool parse_running;
+  SVFProgressCallback progress_callback;
+  void * progress_data;
+  uint64_t progress_interval_ns;
+  uint64_t progress_next_ns;
 
   /* nodes for AXI connections */
   uhal::Node const * nTDI;
@@ -56,4 +200,73 @@ private:
   uhal::Node const * nTMS;
   uhal::Node const * nLength;
   uhal::Node const * nGO;
+
+  /* registers mapped directly, see SetMock */
+  axi_jtag_regs volatile * direct_regs;
+
+  /* batched dispatch */
+  uhal::HwInterface * const * hwInterface;
+  size_t batch_words;
+  size_t poll_reads;
+  UIOIRQ irq;
+  std::mutex * bus_mutex; //shared with the players of the other chains, see SetBusMutex
+  struct pending_word {
+    uint32_t length;
+    uint32_t tms;
+    uint32_t tdi;
+    uhal::ValWord<uint32_t> go;
+    uhal::ValWord<uint32_t> tdo;
+    uint32_t tdo_expected;
+    uint32_t tdo_mask;
+    uint64_t first_tck;
+  };
+  std::vector<pending_word> pending_words;
+
+  /* TDO verification */
+  uint64_t word_tck; //TCK count at bit 0 of the buffered word
+  uint64_t io_tck;   //TCKs sent to the core
+  std::atomic<int> tdo_errors;
+  struct tdo_scan {
+    uint64_t first_tck;
+    int len;
+    int command;
+  };
+  std::vector<tdo_scan> tdo_scans; //scans with TDO checks not yet read back
+
+  /* compiled programs */
+  bool recording;
+  bool compile_only;
+  std::vector<uint32_t> program_ops;
+  size_t program_run;       //op word of the run being recorded
+  uint32_t program_run_op;
+  std::string cache_dir;
+
+  /* parser -> bus I/O pipeline */
+  enum jtag_word_type {
+    JTAG_WORD,   //a word to shift
+    JTAG_SCAN,   //a scan with TDO checks starts: first_tck, length, command in tms
+    JTAG_DELAY,  //RUNTEST wait of first_tck usecs
+    JTAG_FENCE,  //pipeline_drain() marker
+    JTAG_END
+  };
+  struct jtag_word {
+    uint32_t type;
+    uint32_t length;
+    uint32_t tms;
+    uint32_t tdi;
+    uint32_t tdo;
+    uint32_t tdo_mask;
+    uint64_t first_tck;
+  };
+  size_t pipeline_words; //ring size, 0 disables the pipeline
+  bool pipelined;        //the I/O thread is running
+  std::vector<jtag_word> ring;
+  spsc_ring ring_index;          //the parser produces, the I/O thread consumes
+  size_t ring_tail_cache;        //the parser's last look at ring_index.tail
+  uint64_t fences_sent;
+  std::atomic<uint64_t> fences_done;
+  std::atomic<bool> io_abort;
+  std::atomic<bool> io_failed;
+  std::exception_ptr io_error;
+  std::thread io_thread;
 };
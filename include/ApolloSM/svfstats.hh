@@ -0,0 +1,31 @@
+#ifndef __SVFSTATS_HH__
+#define __SVFSTATS_HH__
+
+#include <stdint.h>
+
+//Where the time of an SVF playback went, filled in by SVFPlayer
+struct SVFStats {
+  uint64_t tcks;        //TCKs clocked, including TAP moves and RUNTEST idle clocks
+  uint64_t tdi_bits;    //significant TDI bits of the scans
+  uint64_t tdo_bits;    //TDO bits checked
+  uint64_t tdo_errors;  //TDO words that did not match
+  uint64_t words;       //AXI JTAG words (GO writes)
+  uint64_t writes;      //bus write transactions
+  uint64_t reads;       //bus read transactions, GO polls included
+  uint64_t dispatches;
+  uint64_t irq_sleeps;  //GO waits that slept on the core's interrupt
+  double total_seconds;
+  double parse_seconds; //parsing thread time, without its bus I/O and waits
+  double bus_seconds;   //writing words and waiting on the core, GO polling included
+  double poll_seconds;  //spinning on GO
+  double delay_seconds; //RUNTEST waits
+  double progress;      //fraction of the file played
+
+  double TCKRate() const {return (total_seconds > 0) ? tcks/total_seconds : 0;}
+};
+
+//Called about every progress interval from the thread doing the bus I/O: the
+//one in play(), or the pipeline's I/O thread with SVFPlayer::SetPipeline
+typedef void (*SVFProgressCallback)(SVFStats const & stats, void * data);
+
+#endif
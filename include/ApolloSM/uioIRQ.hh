@@ -0,0 +1,66 @@
+#ifndef __UIOIRQ_HH__
+#define __UIOIRQ_HH__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+//Waits for a core on a UIO device to finish: spins for a short, adaptive
+//time and then sleeps on the device interrupt.  Without an open device
+//WaitFor just spins.
+class UIOIRQ {
+public:
+  UIOIRQ();
+  ~UIOIRQ();
+  //Opens a UIO device (/dev/uioN), returns -1 if its interrupt can't be used
+  int Open(std::string const & device);
+  void Close();
+  bool IsOpen() const {return fd >= 0;}
+  //Longest spin before sleeping, the spin shrinks when waits run longer than this
+  void SetSpin(uint32_t usecs);
+  //Waits until busy() returns false
+  template<class Busy> void WaitFor(Busy busy);
+  //Waits that ended up sleeping on the interrupt
+  uint64_t Sleeps() const {return sleeps;}
+
+private:
+  UIOIRQ(UIOIRQ const &);
+  UIOIRQ & operator=(UIOIRQ const &);
+
+  static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+  uint64_t spin_limit() const;
+  void record(uint64_t waitNs);
+  int arm();
+  void sleep();
+
+  int fd;
+  uint64_t spin_ns;    //spin ceiling
+  uint64_t typical_ns; //running average of the wait times
+  uint64_t sleeps;
+};
+
+template<class Busy> void UIOIRQ::WaitFor(Busy busy) {
+  uint64_t start = now_ns();
+  uint64_t limit = IsOpen() ? spin_limit() : UINT64_MAX;
+  while (busy()) {
+    if (now_ns() - start < limit) {
+      continue;
+    }
+    //re-arm before the last look so a completion in between still wakes us
+    sleeps++;
+    while (arm() == 0 && busy()) {
+      sleep();
+    }
+    //without a working interrupt fall back to spinning
+    while (busy()) {
+    }
+    break;
+  }
+  record(now_ns() - start);
+}
+
+#endif
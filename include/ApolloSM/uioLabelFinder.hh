@@ -0,0 +1,54 @@
+#ifndef __UIO_LABEL_FINDER_HH__
+#define __UIO_LABEL_FINDER_HH__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+//Index file kept between runs, rebuilt whenever the device tree or the UIO devices change.
+//In root's /run, so only root (SM_boot) writes it; other users just scan
+#define UIO_INDEX_CACHE_FILE "/run/uioLabelIndex"
+
+struct uio_device {
+  std::string label; //label property of the device tree node
+  int uio;           //N of /dev/uioN
+  uint64_t addr;     //physical address of map0
+  uint64_t size;     //bytes in map0
+};
+
+//Label to UIO device index, built from one walk over /proc/device-tree/amba_pl/
+//and /sys/class/uio/
+class UIOIndex {
+public:
+  UIOIndex();
+  //Loads the index from cacheFile if it still matches the system, otherwise scans
+  //and rewrites it. "" always scans. Returns the number of devices found.
+  int Load(std::string const & cacheFile = UIO_INDEX_CACHE_FILE);
+  //NULL if no UIO device has the label
+  uio_device const * Find(std::string const & label) const;
+  //UIO numbers of labels in order, -1 for the ones not found
+  std::vector<int> Find(std::vector<std::string> const & labels) const;
+  std::vector<uio_device> const & Devices() const {return devices;}
+  //True if the device tree or the UIO devices changed since Load, e.g. an overlay was loaded
+  bool Changed() const {return signature() != loaded_signature;}
+private:
+  static uint64_t signature();
+  int scan();
+  bool read_cache(std::string const & cacheFile, uint64_t sig);
+  void write_cache(std::string const & cacheFile, uint64_t sig) const;
+  void build_map();
+
+  std::vector<uio_device> devices;
+  std::map<std::string, size_t> by_label;
+  uint64_t loaded_signature;
+};
+
+//The UIO number of a label (-1 if none) from an index shared by the whole process
+int label2uio(std::string const & label);
+//Several labels at once, -1 for the ones not found
+std::vector<int> label2uio(std::vector<std::string> const & labels);
+//The whole entry of a label from the same index, NULL if none
+uio_device const * label2device(std::string const & label);
+
+#endif
@@ -55,6 +55,13 @@ namespace BUTool{
     CommandReturn::status StatusDisplay(std::vector<std::string>,std::vector<uint64_t>);
 
     CommandReturn::status svfplayer(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status svfmulti(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status svfcompile(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status svfcache(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status svfpipeline(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status svfirq(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status svfmock(std::vector<std::string>,std::vector<uint64_t>);
+    CommandReturn::status directio(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status UART_Term(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status UART_CMD(std::vector<std::string>,std::vector<uint64_t>);
     CommandReturn::status GenerateHTMLStatus(std::vector<std::string>,std::vector<uint64_t>);
@@ -0,0 +1,87 @@
+#ifndef __STANDALONE_XVC_SHIFT_HH__
+#define __STANDALONE_XVC_SHIFT_HH__
+
+#include <stdint.h>
+#include <string.h>
+
+#include <ApolloSM/axiJTAG.hh>
+
+//Shifts len bits of TMS/TDI through the core, 32 at a time, LSB first.
+//TDO goes straight into result. The next TMS/TDI pair is loaded while the
+//core shifts the current one.
+//wait() returns once ctrl reads 0 again, trace(length,tms,tdi,tdo)
+//sees every word and is compiled out with Verbose false.  shared adds the
+//barriers registers in ordinary memory, served by another thread or
+//process, need.
+template<bool Verbose, class Wait, class Trace>
+inline void xvc_shift_vector(axi_jtag_regs volatile * pXVC, bool shared, Wait wait, Trace trace,
+			     unsigned char const * tmsBytes, unsigned char const * tdiBytes,
+			     unsigned char * result, int len) {
+  int nWords = len / 32;
+  uint32_t tms = 0, tdi = 0, tdo;
+  if (nWords > 0) {
+    memcpy(&tms, tmsBytes, 4);
+    memcpy(&tdi, tdiBytes, 4);
+  }
+  for (int iWord = 0; iWord < nWords; iWord++) {
+    pXVC->length = 32;
+    pXVC->tms = tms;
+    pXVC->tdi = tdi;
+    if (shared) {
+      __sync_synchronize();
+    }
+    pXVC->ctrl = 0x01;
+
+    uint32_t nextTMS = 0, nextTDI = 0;
+    int next = 4*(iWord + 1);
+    if (iWord + 1 < nWords) {
+      memcpy(&nextTMS, &tmsBytes[next], 4);
+      memcpy(&nextTDI, &tdiBytes[next], 4);
+      __builtin_prefetch(&tmsBytes[next + 64]);
+      __builtin_prefetch(&tdiBytes[next + 64]);
+    }
+
+    wait();
+    if (shared) {
+      __sync_synchronize();
+    }
+
+    tdo = pXVC->tdo;
+    memcpy(&result[4*iWord], &tdo, 4);
+    if (Verbose) {
+      trace(32, tms, tdi, tdo);
+    }
+    tms = nextTMS;
+    tdi = nextTDI;
+  }
+
+  int bitsLeft = len - 32*nWords;
+  if (bitsLeft > 0) {
+    int byteIndex = 4*nWords;
+    int bytesLeft = (bitsLeft + 7) / 8;
+    tms = 0;
+    tdi = 0;
+    memcpy(&tms, &tmsBytes[byteIndex], bytesLeft);
+    memcpy(&tdi, &tdiBytes[byteIndex], bytesLeft);
+
+    pXVC->length = bitsLeft;
+    pXVC->tms = tms;
+    pXVC->tdi = tdi;
+    if (shared) {
+      __sync_synchronize();
+    }
+    pXVC->ctrl = 0x01;
+    wait();
+    if (shared) {
+      __sync_synchronize();
+    }
+
+    tdo = pXVC->tdo;
+    memcpy(&result[byteIndex], &tdo, bytesLeft);
+    if (Verbose) {
+      trace(bitsLeft, tms, tdi, tdo);
+    }
+  }
+}
+
+#endif
@@ -1,11 +1,12 @@
 #include <ApolloSM/ApolloSM.hh>
 #include <fstream> //std::ofstream
 
-ApolloSM::ApolloSM():IPBusConnection("ApolloSM"),statusDisplay(NULL){  
+ApolloSM::ApolloSM():IPBusConnection("ApolloSM"),statusDisplay(NULL),svfPipelineWords(0),svfIRQSpin(0),directIO(false),directGeneration(1){  
   statusDisplay= new IPBusStatus(GetHWInterface());
 }
 
 ApolloSM::~ApolloSM(){
+  directRelease();
   if(statusDisplay != NULL){
     delete statusDisplay;
   }
@@ -68,18 +69,21 @@ bool ApolloSM::PowerUpCM(int CM_ID, int wait /*seconds*/){
     CM_CTRL+="1";
   }
   CM_CTRL+=".CTRL.";
+  RegisterHandle enableUC  = GetRegisterHandle(CM_CTRL+"ENABLE_UC");
+  RegisterHandle enablePWR = GetRegisterHandle(CM_CTRL+"ENABLE_PWR");
+  RegisterHandle state     = GetRegisterHandle(CM_CTRL+"STATE");
 
   //Check that the uC is powered up, power up if needed
-  if(!RegReadRegister(CM_CTRL+"ENABLE_UC")){
-    RegWriteRegister(CM_CTRL+"ENABLE_UC",1);
+  if(!enableUC.Read()){
+    enableUC.Write(1);
   }
   //Power up the CM 
-  RegWriteRegister(CM_CTRL+"ENABLE_PWR",1);
+  enablePWR.Write(1);
   usleep(10000); //Wait 10ms
   
   wait*=1000000; //convert wait time to us from s
   do{
-    if(RegReadRegister(CM_CTRL+"STATE") == RUNNING_STATE){
+    if(state.Read() == RUNNING_STATE){
       return true;
      }
     int dt = 10000;//10ms
@@ -87,7 +91,7 @@ bool ApolloSM::PowerUpCM(int CM_ID, int wait /*seconds*/){
     wait-=dt;
   }while(wait >= 0);
 
-  RegWriteRegister(CM_CTRL+"ENABLE_PWR",0);
+  enablePWR.Write(0);
   
   return false;
 }
@@ -110,13 +114,15 @@ bool ApolloSM::PowerDownCM(int CM_ID, int wait /*seconds*/){
     CM_CTRL+="1";
   }
   CM_CTRL+=".CTRL.";
+  RegisterHandle enablePWR = GetRegisterHandle(CM_CTRL+"ENABLE_PWR");
+  RegisterHandle state     = GetRegisterHandle(CM_CTRL+"STATE");
 
-  RegWriteRegister(CM_CTRL+"ENABLE_PWR",0);
+  enablePWR.Write(0);
   usleep(10000); //Wait 10ms
   
   wait*=1000000; //convert wait time to us from s
   do{
-    if( RegReadRegister(CM_CTRL+"STATE") == RESET_STATE ){
+    if( state.Read() == RESET_STATE ){
       //PWR GOOD went off
       break;
     }
@@ -125,9 +131,7 @@ bool ApolloSM::PowerDownCM(int CM_ID, int wait /*seconds*/){
     wait-=dt;
   }while(wait >= 0);  
 
-  uint32_t state = RegReadRegister(CM_CTRL+"STATE");
-
-  if(PWR_DOWN_STATE == state){
+  if(PWR_DOWN_STATE == state.Read()){
     //We just shut off the uC before power good went down.  
     //We gave up
     return false;
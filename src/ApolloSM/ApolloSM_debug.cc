@@ -1,52 +1,197 @@
 #include <ApolloSM/ApolloSM.hh>
-#include <BUTool/ToolException.hh>
-#include <uhal/ProtocolUIO.hpp>
+#include <ApolloSM/registerSnapshot.hh>
+#include <ApolloSM/spscRing.hh>
 #include <iostream>
-#include <iomanip> 
+#include <unistd.h>
+#include <time.h>
 
-void ApolloSM::DebugDump(std::ostream & output){
+static uint64_t realtime_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//One line per register, formatted into a single buffer
+static void dump_snapshot(std::ostream & output, RegisterSnapshot const & snapshot,
+			  uint32_t const * values, uint8_t const * status) {
+  std::vector<std::string> const & names = snapshot.Names();
+  std::string text;
+  text.reserve(names.size() * 76);
+  char line[128];
+  for (size_t iReg = 0; iReg < names.size(); iReg++) {
+    //Name
+    text.append(names[iReg].size() < 60 ? 60 - names[iReg].size() : 0, ' ');
+    text += names[iReg];
+    text += " : ";
+    switch (status[iReg]) {
+    case RegisterSnapshot::READ_OK:
+      snprintf(line, sizeof(line), "0x%08x\n", values[iReg]);
+      text += line;
+      break;
+    case RegisterSnapshot::WRITE_ONLY:
+      text += "Write Only\n";
+      break;
+    default:
+      text += "BusErr\n";
+      break;
+    }
+  }
+  output.write(text.data(), text.size());
+}
+
+void ApolloSM::DebugDump(std::ostream & output, std::string const & binaryFile){
   //Get all the register names
   std::vector<std::string> registers = myMatchRegex("*");
   int sleepLength=1;
+
+  //resolve them once, then both reads are a single dispatch each
+  RegisterSnapshot snapshot(GetHWInterface());
+  snapshot.Build(registers);
+  size_t nRegs = snapshot.Size();
+  if (nRegs == 0) {
+    output << "No registers to dump\n";
+    return;
+  }
+  std::vector<uint32_t> values(2*nRegs);
+  std::vector<uint8_t> status(2*nRegs);
+  uint64_t times[2];
   
-  //read out each
-  uint32_t val;  
-  for(std::vector<std::string>::iterator itReg = registers.begin();
-      itReg != registers.end();
-      ++itReg){
-    //Name
-    output << std::setw(60) << std::setfill(' ') << std::right << *itReg;
-    output << " : ";
-    try{
-      val = RegReadRegister(*itReg);
-      output << "0x" << std::setfill('0') << std::setw(8) << std::hex << val << std::endl;
-    }catch(uhal::exception::UIOBusError & e){
-      output << "BusErr" << std::endl;
-    }catch(BUException::REG_READ_DENIED & e){
-      output << "Write Only" << std::endl;
-    }
+  times[0] = realtime_ns();
+  snapshot.Take(&values[0], &status[0]);
+  sleep(sleepLength);
+  times[1] = realtime_ns();
+  snapshot.Take(&values[nRegs], &status[nRegs]);
 
+  if (!binaryFile.empty()) {
+    snapshot.Save(binaryFile, 2, &values[0], &status[0], times);
   }
+
+  //formatting waits until both reads are done
+  dump_snapshot(output, snapshot, &values[0], &status[0]);
   output << "\n\n" 
 	 << "============================================================\n"
 	 << "== Sleep: " << sleepLength  << "s\n"
 	 << "============================================================\n"
 	 << "\n\n";
-  sleep(sleepLength);
-  for(std::vector<std::string>::iterator itReg = registers.begin();
-      itReg != registers.end();
-      ++itReg){
-    //Name
-    output << std::setw(60) << std::setfill(' ') << std::right << *itReg;
-    output << " : ";
-    try{
-      val = RegReadRegister(*itReg);
-      output << "0x" << std::setfill('0') << std::setw(8) << std::hex << val << std::endl;
-    }catch(uhal::exception::UIOBusError & e){
-      output << std::string("BusErr") << std::endl;
-    }catch(BUException::REG_READ_DENIED & e){
-      output << "Write Only" << std::endl;
+  dump_snapshot(output, snapshot, &values[nRegs], &status[nRegs]);
+}
+
+/*
+ * Delta dumps
+ *
+ * The snapshots go into a column per register (all the values of one
+ * register next to each other), so finding the registers that changed is a
+ * scan down each column.  Only those are printed, as runs of equal values.
+ */
+
+//Appends "value*count" for each run of equal readings
+static void append_runs(std::string & text, uint32_t const * values, uint8_t const * status, size_t n) {
+  char word[48];
+  size_t start = 0;
+  for (size_t i = 1; i <= n; i++) {
+    if (i < n && values[i] == values[start] && status[i] == status[start]) {
+      continue;
     }
+    switch (status[start]) {
+    case RegisterSnapshot::READ_OK:
+      snprintf(word, sizeof(word), " 0x%08x*%zu", values[start], i - start);
+      break;
+    case RegisterSnapshot::WRITE_ONLY:
+      snprintf(word, sizeof(word), " WriteOnly*%zu", i - start);
+      break;
+    default:
+      snprintf(word, sizeof(word), " BusErr*%zu", i - start);
+      break;
+    }
+    text += word;
+    start = i;
+  }
+}
+
+void ApolloSM::DebugDumpDelta(std::ostream & output, size_t snapshots, double interval,
+			      std::string const & binaryFile){
+  if (snapshots < 2) {
+    snapshots = 2;
+  }
+  std::vector<std::string> registers = myMatchRegex("*");
+  RegisterSnapshot snapshot(GetHWInterface());
+  snapshot.Build(registers);
+  size_t nRegs = snapshot.Size();
+  if (nRegs == 0) {
+    output << "No registers to dump\n";
+    return;
+  }
+
+  //column store, register iReg's readings are at [iReg*snapshots, (iReg+1)*snapshots)
+  std::vector<uint32_t> values(nRegs*snapshots);
+  std::vector<uint8_t> status(nRegs*snapshots);
+  std::vector<uint32_t> rowValues(nRegs);
+  std::vector<uint8_t> rowStatus(nRegs);
+  std::vector<uint64_t> times(snapshots);
+  uint64_t intervalNs = interval > 0 ? interval*1E9 : 0;
+  uint64_t next = monotonic_ns();
+  for (size_t iSnap = 0; iSnap < snapshots; iSnap++) {
+    if (iSnap > 0) {
+      next += intervalNs;
+      uint64_t now = monotonic_ns();
+      if (next > now) {
+	usleep((next - now) / 1000);
+      }
+    }
+    times[iSnap] = realtime_ns();
+    snapshot.Take(&rowValues[0], &rowStatus[0]);
+    for (size_t iReg = 0; iReg < nRegs; iReg++) {
+      values[iReg*snapshots + iSnap] = rowValues[iReg];
+      status[iReg*snapshots + iSnap] = rowStatus[iReg];
+    }
+  }
+
+  //changes per register
+  std::vector<size_t> changed;
+  std::vector<size_t> changes;
+  for (size_t iReg = 0; iReg < nRegs; iReg++) {
+    uint32_t const * column = &values[iReg*snapshots];
+    uint8_t const * columnStatus = &status[iReg*snapshots];
+    size_t count = 0;
+    for (size_t iSnap = 1; iSnap < snapshots; iSnap++) {
+      count += (column[iSnap] != column[iSnap-1]) || (columnStatus[iSnap] != columnStatus[iSnap-1]);
+    }
+    if (count) {
+      changed.push_back(iReg);
+      changes.push_back(count);
+    }
+  }
+
+  if (!binaryFile.empty()) {
+    //only the registers that changed, back in snapshot order
+    std::vector<uint32_t> subsetValues(changed.size()*snapshots);
+    std::vector<uint8_t> subsetStatus(changed.size()*snapshots);
+    for (size_t iSnap = 0; iSnap < snapshots; iSnap++) {
+      for (size_t i = 0; i < changed.size(); i++) {
+	subsetValues[iSnap*changed.size() + i] = values[changed[i]*snapshots + iSnap];
+	subsetStatus[iSnap*changed.size() + i] = status[changed[i]*snapshots + iSnap];
+      }
+    }
+    snapshot.Save(binaryFile, snapshots,
+		  subsetValues.empty() ? NULL : &subsetValues[0],
+		  subsetStatus.empty() ? NULL : &subsetStatus[0],
+		  &times[0], &changed);
+  }
 
+  std::string text;
+  char line[160];
+  snprintf(line, sizeof(line), "%zu snapshots %.3fs apart, %zu of %zu registers changed\n\n",
+	   snapshots, interval, changed.size(), nRegs);
+  text += line;
+  std::vector<std::string> const & names = snapshot.Names();
+  for (size_t i = 0; i < changed.size(); i++) {
+    size_t iReg = changed[i];
+    text.append(names[iReg].size() < 60 ? 60 - names[iReg].size() : 0, ' ');
+    text += names[iReg];
+    snprintf(line, sizeof(line), " : %zu changes :", changes[i]);
+    text += line;
+    append_runs(text, &values[iReg*snapshots], &status[iReg*snapshots], snapshots);
+    text += "\n";
   }
+  output.write(text.data(), text.size());
 }
@@ -0,0 +1,238 @@
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/uioLabelFinder.hh>
+#include <uhal/ProtocolUIO.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <mutex>
+
+/*
+ * Direct UIO register access
+ *
+ * On the Zynq the registers of a uioaxi connection are in UIO devices this
+ * process can map itself.  Each register name is resolved once, through the
+ * uHAL node, to a pointer into the map of its top level node (the UIO label)
+ * plus its mask, so a read is a hash lookup and a load.  A bad address raises
+ * SIGBUS, which is turned into the same UIOBusError uHAL throws.
+ */
+
+//volatile so the stores around a guarded access stay where they are
+static thread_local sigjmp_buf * volatile busErrorJump = NULL;
+static struct sigaction oldBusAction;
+static std::once_flag busHandlerInstalled;
+
+static void bus_error_handler(int sig, siginfo_t * info, void * context) {
+  if (busErrorJump != NULL) {
+    siglongjmp(*busErrorJump, 1);
+  }
+  //not one of our accesses, pass it on
+  if (oldBusAction.sa_flags & SA_SIGINFO) {
+    oldBusAction.sa_sigaction(sig, info, context);
+  } else if (oldBusAction.sa_handler != SIG_DFL && oldBusAction.sa_handler != SIG_IGN) {
+    oldBusAction.sa_handler(sig);
+  } else {
+    signal(SIGBUS, SIG_DFL);
+    raise(SIGBUS);
+  }
+}
+
+static void install_bus_handler() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = bus_error_handler;
+  //SIGBUS stays unblocked after the jump out of the handler
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGBUS, &sa, &oldBusAction);
+}
+
+static uint32_t direct_load(uint32_t volatile * addr) {
+  sigjmp_buf jump;
+  if (sigsetjmp(jump, 0)) {
+    busErrorJump = NULL;
+    throw uhal::exception::UIOBusError();
+  }
+  busErrorJump = &jump;
+  uint32_t value = *addr;
+  busErrorJump = NULL;
+  return value;
+}
+
+static void direct_store(uint32_t volatile * addr, uint32_t value) {
+  sigjmp_buf jump;
+  if (sigsetjmp(jump, 0)) {
+    busErrorJump = NULL;
+    throw uhal::exception::UIOBusError();
+  }
+  busErrorJump = &jump;
+  *addr = value;
+  busErrorJump = NULL;
+}
+
+bool ApolloSM::EnableDirectIO(bool enable) {
+  directRelease();
+  directIO = false;
+  if (!enable) {
+    return true;
+  }
+  uhal::HwInterface * const * hw = GetHWInterface();
+  if (hw == NULL || *hw == NULL || (*hw)->getClient().uri().compare(0, 6, "uioaxi") != 0) {
+    //remote, everything stays on uHAL
+    return false;
+  }
+  std::call_once(busHandlerInstalled, install_bus_handler);
+  directIO = true;
+  return true;
+}
+
+//Maps the UIO device of a top level node once
+ApolloSM::directMap const & ApolloSM::directMapOf(std::string const & top) {
+  std::map<std::string, directMap>::iterator it = directMaps.find(top);
+  if (it != directMaps.end()) {
+    return it->second;
+  }
+  directMap map = {NULL, 0, 0};
+  uio_device const * device = label2device(top);
+  if (device != NULL && device->size > 0) {
+    char uioFileName[64];
+    snprintf(uioFileName, sizeof(uioFileName), "/dev/uio%d", device->uio);
+    int fd = open(uioFileName, O_RDWR);
+    if (fd >= 0) {
+      void * regs = mmap(NULL, device->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+      if (MAP_FAILED != regs) {
+	map.base = (uint32_t volatile *) regs;
+	map.size = device->size;
+	map.nodeAddr = GetNode(top).getAddress();
+      }
+    }
+  }
+  return directMaps.insert(std::make_pair(top, map)).first->second;
+}
+
+//Pointer and mask of a register, a NULL pointer sends it through uHAL
+ApolloSM::directReg const & ApolloSM::directResolve(std::string const & reg) {
+  std::unordered_map<std::string, directReg>::iterator it = directRegs.find(reg);
+  if (it != directRegs.end()) {
+    return it->second;
+  }
+  directReg direct = {NULL, 0xFFFFFFFF, 0, false, false};
+  uhal::Node const & node = GetNode(reg);
+  directMap const & map = directMapOf(reg.substr(0, reg.find('.')));
+  if (map.base != NULL && node.getMode() == uhal::defs::SINGLE &&
+      node.getAddress() >= map.nodeAddr) {
+    size_t offset = node.getAddress() - map.nodeAddr;
+    if ((offset + 1) * sizeof(uint32_t) <= map.size && node.getMask() != 0) {
+      direct.addr = map.base + offset;
+      direct.mask = node.getMask();
+      direct.shift = __builtin_ctz(direct.mask);
+      direct.readable = node.getPermission() & uhal::defs::READ;
+      direct.writable = node.getPermission() & uhal::defs::WRITE;
+    }
+  }
+  return directRegs.insert(std::make_pair(reg, direct)).first->second;
+}
+
+void ApolloSM::directRelease() {
+  for (std::map<std::string, directMap>::iterator it = directMaps.begin(); it != directMaps.end(); ++it) {
+    if (it->second.base != NULL) {
+      munmap((void *) it->second.base, it->second.size);
+    }
+  }
+  directMaps.clear();
+  directRegs.clear();
+  directGeneration++;
+}
+
+uint32_t ApolloSM::directRead(directReg const & direct) {
+  return (direct_load(direct.addr) & direct.mask) >> direct.shift;
+}
+
+//False if uHAL has to do the write: it reports values that don't fit and
+//does masked writes to registers that can't be read back
+bool ApolloSM::directWrite(directReg const & direct, uint32_t value) {
+  if (direct.addr == NULL || !direct.writable ||
+      (value & ~(direct.mask >> direct.shift)) != 0 ||
+      !(direct.readable || direct.mask == 0xFFFFFFFF)) {
+    return false;
+  }
+  if (direct.mask == 0xFFFFFFFF) {
+    direct_store(direct.addr, value);
+  } else {
+    direct_store(direct.addr, (direct_load(direct.addr) & ~direct.mask) | (value << direct.shift));
+  }
+  return true;
+}
+
+uint32_t ApolloSM::RegReadRegister(std::string const & reg) {
+  if (directIO) {
+    directReg const & direct = directResolve(reg);
+    if (direct.addr != NULL && direct.readable) {
+      return directRead(direct);
+    }
+  }
+  return IPBusConnection::RegReadRegister(reg);
+}
+
+void ApolloSM::RegWriteRegister(std::string const & reg, uint32_t value) {
+  if (directIO && directWrite(directResolve(reg), value)) {
+    return;
+  }
+  IPBusConnection::RegWriteRegister(reg, value);
+}
+
+/*
+ * Register handles
+ *
+ * A handle keeps the uHAL node of its register and, once direct IO is on,
+ * a pointer to the resolved entry in directRegs.  The entry is looked up
+ * again after EnableDirectIO() drops the maps (directGeneration changes).
+ */
+
+ApolloSM::RegisterHandle ApolloSM::GetRegisterHandle(std::string const & reg) {
+  RegisterHandle handle;
+  handle.node = &GetNode(reg);
+  handle.sm = this;
+  handle.name = reg;
+  return handle;
+}
+
+ApolloSM::RegisterHandle::RegisterHandle():sm(NULL),node(NULL),direct(NULL),directGeneration(0) {
+}
+
+//The direct entry of the register, NULL when it goes through uHAL
+ApolloSM::directReg const * ApolloSM::RegisterHandle::resolve() const {
+  if (sm == NULL) {
+    BUException::APOLLO_SM_BAD_VALUE e;
+    e.Append("Register handle used before GetRegisterHandle()");
+    throw e;
+  }
+  if (!sm->directIO) {
+    return NULL;
+  }
+  if (directGeneration != sm->directGeneration) {
+    direct = &sm->directResolve(name);
+    directGeneration = sm->directGeneration;
+  }
+  return direct;
+}
+
+uint32_t ApolloSM::RegisterHandle::Read() const {
+  directReg const * reg = resolve();
+  if (reg != NULL && reg->addr != NULL && reg->readable) {
+    return sm->directRead(*reg);
+  }
+  return sm->RegReadNode(*node);
+}
+
+void ApolloSM::RegisterHandle::Write(uint32_t value) const {
+  directReg const * reg = resolve();
+  if (reg != NULL && sm->directWrite(*reg, value)) {
+    return;
+  }
+  sm->RegWriteNode(*node, value);
+}
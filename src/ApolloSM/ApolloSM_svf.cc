@@ -1,13 +1,172 @@
 #include <ApolloSM/ApolloSM.hh>
 #include <ApolloSM/svfplayer.hh>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <sys/time.h>
 
-int ApolloSM::svfplayer(std::string const & svfFile, std::string const & XVCReg) {
+struct svf_chain {
+  std::unique_ptr<SVFPlayer> player;
+  std::string svfFile;
+  std::string XVCReg;
+  int rc;
+  std::string error;
+  std::atomic<bool> done;
+};
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1E-6*tv.tv_usec;
+}
+
+static void svf_chain_play(svf_chain * chain) {
+  try {
+    chain->rc = chain->player->play(chain->svfFile, chain->XVCReg);
+  } catch (BUException::exBase const & e) {
+    chain->error = e.Description();
+    chain->rc = -1;
+  } catch (std::exception const & e) {
+    chain->error = e.what();
+    chain->rc = -1;
+  }
+  chain->done = true;
+}
+
+int ApolloSM::svfplayer(std::string const & svfFile, std::string const & XVCReg,
+			size_t batchWords, size_t pollReads,
+			SVFStats * stats,
+			SVFProgressCallback progress, void * progressData) {
 
   SVFPlayer SVF(GetHWInterface());
+  SVF.SetBatch(batchWords, pollReads);
+  SVF.SetCache(svfCacheDir);
+  SVF.SetPipeline(svfPipelineWords);
+  if (!svfIRQDevice.empty() && SVF.SetIRQ(svfIRQDevice, svfIRQSpin) < 0) {
+    fprintf(stderr, "Polling GO without the interrupt of %s.\n", svfIRQDevice.c_str());
+  }
+  if (!svfMockFile.empty() && SVF.SetMock(svfMockFile) < 0) {
+    return -1;
+  }
+  if (progress != NULL) {
+    SVF.SetProgressCallback(progress, progressData);
+  }
   int rc = SVF.play(svfFile, XVCReg);
+  if (stats != NULL) {
+    *stats = SVF.Stats();
+  }
 
   if(rc == 0) {fprintf(stderr, "SVFplayer ran without errors.\n");}
   else {fprintf(stderr, "SVFplayer ran with errors.\n");}
 
   return rc;
-} 
+}
+
+int ApolloSM::svfplayer(std::vector<std::pair<std::string,std::string> > const & chains,
+			size_t batchWords, size_t pollReads,
+			std::vector<SVFStats> * stats) {
+  //the chains share one bus, a dispatch only ever carries one chain's words
+  std::mutex busMutex;
+  std::vector<svf_chain> chain(chains.size());
+  std::vector<std::thread> threads;
+  for (size_t iChain = 0; iChain < chains.size(); iChain++) {
+    chain[iChain].player.reset(new SVFPlayer(GetHWInterface()));
+    chain[iChain].player->SetBatch(batchWords, pollReads);
+    chain[iChain].player->SetCache(svfCacheDir);
+    chain[iChain].player->SetPipeline(svfPipelineWords);
+    chain[iChain].player->SetBusMutex(&busMutex);
+    chain[iChain].svfFile = chains[iChain].first;
+    chain[iChain].XVCReg = chains[iChain].second;
+    chain[iChain].rc = -1;
+    chain[iChain].done = false;
+  }
+  //no reallocation while a started thread is being stored
+  threads.reserve(chain.size());
+  try {
+    for (size_t iChain = 0; iChain < chain.size(); iChain++) {
+      threads.push_back(std::thread(svf_chain_play, &chain[iChain]));
+    }
+  } catch (...) {
+    //the chains already started still use chain, let them finish
+    for (size_t iThread = 0; iThread < threads.size(); iThread++) {
+      threads[iThread].join();
+    }
+    throw;
+  }
+
+  //progress of each chain once a second until they are all done
+  double start = now();
+  bool running = !chain.empty();
+  while (running) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    running = false;
+    for (size_t iChain = 0; iChain < chain.size(); iChain++) {
+      running |= !chain[iChain].done;
+    }
+    if (!running || (now() - start) < 1.0) {
+      continue;
+    }
+    start = now();
+    for (size_t iChain = 0; iChain < chain.size(); iChain++) {
+      fprintf(stderr, "%s: %5.1f%% %llu TCKs%s\n",
+	      chain[iChain].XVCReg.c_str(),
+	      100.0*chain[iChain].player->Progress(),
+	      (unsigned long long) chain[iChain].player->TCKs(),
+	      chain[iChain].done ? " done" : "");
+    }
+  }
+
+  int rc = 0;
+  if (stats != NULL) {
+    stats->clear();
+  }
+  for (size_t iChain = 0; iChain < chain.size(); iChain++) {
+    threads[iChain].join();
+    SVFStats chainStats = chain[iChain].player->Stats();
+    fprintf(stderr, "%s: %s %s, %llu TCKs in %.2fs (%.2f MHz, bus %.2fs, parsing %.2fs)\n",
+	    chain[iChain].XVCReg.c_str(),
+	    chain[iChain].svfFile.c_str(),
+	    (chain[iChain].rc == 0) ? "ran without errors" : "ran with errors",
+	    (unsigned long long) chainStats.tcks, chainStats.total_seconds,
+	    1E-6*chainStats.TCKRate(), chainStats.bus_seconds, chainStats.parse_seconds);
+    if (stats != NULL) {
+      stats->push_back(chainStats);
+    }
+    if (!chain[iChain].error.empty()) {
+      fprintf(stderr, "%s: %s\n", chain[iChain].XVCReg.c_str(), chain[iChain].error.c_str());
+    }
+    if (chain[iChain].rc != 0) {
+      rc = -1;
+    }
+  }
+  return rc;
+}
+
+int ApolloSM::svfcompile(std::string const & svfFile, std::string const & programFile) {
+
+  SVFPlayer SVF(GetHWInterface());
+  int rc = SVF.compile(svfFile, programFile);
+
+  if(rc != 0) {fprintf(stderr, "SVF compile failed.\n");}
+
+  return rc;
+}
+
+void ApolloSM::SetSVFCache(std::string const & cacheDir) {
+  svfCacheDir = cacheDir;
+}
+
+void ApolloSM::SetSVFPipeline(size_t ringWords) {
+  svfPipelineWords = ringWords;
+}
+
+void ApolloSM::SetSVFIRQ(std::string const & uioDevice, uint32_t spinUsecs) {
+  svfIRQDevice = uioDevice;
+  svfIRQSpin = spinUsecs;
+}
+
+void ApolloSM::SetSVFMock(std::string const & regFile) {
+  svfMockFile = regFile;
+}
@@ -0,0 +1,35 @@
+#include <ApolloSM/axiJTAG.hh>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+axi_jtag_regs volatile * axi_jtag_map_file(std::string const & regFile) {
+  int fd = open(regFile.c_str(), O_RDWR);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", regFile.c_str(), strerror(errno));
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < AXI_JTAG_MAP_SIZE) {
+    fprintf(stderr, "%s is not a JTAG register file, is jtagSim running?\n", regFile.c_str());
+    close(fd);
+    return NULL;
+  }
+  void * map = mmap(NULL, AXI_JTAG_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == map) {
+    fprintf(stderr, "Failed to mmap %s\n", regFile.c_str());
+    return NULL;
+  }
+  return (axi_jtag_regs volatile *) map;
+}
+
+void axi_jtag_unmap_file(axi_jtag_regs volatile * regs) {
+  if (regs != NULL) {
+    munmap((void *) regs, AXI_JTAG_MAP_SIZE);
+  }
+}
@@ -0,0 +1,180 @@
+#include <ApolloSM/registerSnapshot.hh>
+#include <uhal/ProtocolUIO.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+
+/*
+ * Register snapshots
+ *
+ * Build() turns the register names into a sorted list of the distinct
+ * addresses to read plus, per register, the index of its word and its mask.
+ * Take() reads every run of consecutive addresses with one readBlock and
+ * sends them all in a single dispatch, then picks the fields out of the
+ * words.  A run never crosses into another top level node: with the UIO
+ * protocol each one is its own UIO device (its label) and a block is read
+ * from the device of its first address.  Only addresses of the registers
+ * themselves are read, gaps in the address table are never touched.  If the
+ * dispatch hits a bus error the words are read again one at a time to find
+ * the bad ones.
+ *
+ * Snapshot file: register_snapshot_header, the NUL terminated names, then
+ *   uint32_t address[registers], uint32_t mask[registers],
+ *   uint64_t time_ns[snapshots],
+ *   uint32_t value[snapshots][registers], uint8_t status[snapshots][registers]
+ */
+
+static const char snapshotMagic[8] = {'A','P','O','L','L','O','S','S'};
+//largest block in one readBlock
+static const uint32_t maxBlockWords = 256;
+
+RegisterSnapshot::RegisterSnapshot(uhal::HwInterface * const * _hw):hw(_hw) {
+}
+
+size_t RegisterSnapshot::Build(std::vector<std::string> const & registers) {
+  names = registers;
+  regs.resize(names.size());
+  word_addrs.clear();
+  size_t nReadable = 0;
+  std::map<std::string, uint32_t> tops;
+  std::vector<uint32_t> regTops(names.size());
+  for (size_t iReg = 0; iReg < names.size(); iReg++) {
+    uhal::Node const & node = (*hw)->getNode(names[iReg]);
+    reg_entry & reg = regs[iReg];
+    regTops[iReg] = tops.insert(std::make_pair(names[iReg].substr(0, names[iReg].find('.')),
+					       (uint32_t) tops.size())).first->second;
+    reg.addr = node.getAddress();
+    reg.mask = node.getMask();
+    reg.shift = reg.mask ? __builtin_ctz(reg.mask) : 0;
+    reg.readable = node.getPermission() & uhal::defs::READ;
+    reg.word = 0;
+    if (reg.readable) {
+      word_addrs.push_back(reg.addr);
+      nReadable++;
+    }
+  }
+  std::sort(word_addrs.begin(), word_addrs.end());
+  word_addrs.erase(std::unique(word_addrs.begin(), word_addrs.end()), word_addrs.end());
+  //top level node of every word
+  std::vector<uint32_t> wordTops(word_addrs.size());
+  for (size_t iReg = 0; iReg < regs.size(); iReg++) {
+    if (regs[iReg].readable) {
+      regs[iReg].word = std::lower_bound(word_addrs.begin(), word_addrs.end(), regs[iReg].addr) - word_addrs.begin();
+      wordTops[regs[iReg].word] = regTops[iReg];
+    }
+  }
+
+  //runs of consecutive addresses in one top level node
+  blocks.clear();
+  for (size_t iWord = 0; iWord < word_addrs.size(); iWord++) {
+    if (blocks.empty() ||
+	blocks.back().size == maxBlockWords ||
+	word_addrs[iWord] != word_addrs[iWord - 1] + 1 ||
+	wordTops[iWord] != wordTops[iWord - 1]) {
+      word_block block = {iWord, 0};
+      blocks.push_back(block);
+    }
+    blocks.back().size++;
+  }
+  word_values.assign(word_addrs.size(), 0);
+  word_status.assign(word_addrs.size(), READ_OK);
+  return nReadable;
+}
+
+void RegisterSnapshot::read_words_one_by_one() {
+  uhal::ClientInterface & client = (*hw)->getClient();
+  for (size_t iWord = 0; iWord < word_addrs.size(); iWord++) {
+    try {
+      uhal::ValWord<uint32_t> word = client.read(word_addrs[iWord]);
+      client.dispatch();
+      word_values[iWord] = word.value();
+      word_status[iWord] = READ_OK;
+    } catch (uhal::exception::UIOBusError & e) {
+      word_values[iWord] = 0;
+      word_status[iWord] = BUS_ERROR;
+    }
+  }
+}
+
+void RegisterSnapshot::Take(uint32_t * values, uint8_t * status) {
+  uhal::ClientInterface & client = (*hw)->getClient();
+  try {
+    std::vector<uhal::ValVector<uint32_t> > reads;
+    reads.reserve(blocks.size());
+    for (size_t iBlock = 0; iBlock < blocks.size(); iBlock++) {
+      reads.push_back(client.readBlock(word_addrs[blocks[iBlock].first], blocks[iBlock].size));
+    }
+    client.dispatch();
+    for (size_t iBlock = 0; iBlock < blocks.size(); iBlock++) {
+      size_t first = blocks[iBlock].first;
+      for (uint32_t iWord = 0; iWord < blocks[iBlock].size; iWord++) {
+	word_values[first + iWord] = reads[iBlock][iWord];
+	word_status[first + iWord] = READ_OK;
+      }
+    }
+  } catch (uhal::exception::UIOBusError & e) {
+    read_words_one_by_one();
+  }
+
+  for (size_t iReg = 0; iReg < regs.size(); iReg++) {
+    reg_entry const & reg = regs[iReg];
+    if (!reg.readable) {
+      values[iReg] = 0;
+      status[iReg] = WRITE_ONLY;
+    } else {
+      values[iReg] = (word_values[reg.word] & reg.mask) >> reg.shift;
+      status[iReg] = word_status[reg.word];
+    }
+  }
+}
+
+//Written to a temporary file and renamed, so readers never see half of it
+int RegisterSnapshot::Save(std::string const & fileName, size_t nSnapshots,
+			   uint32_t const * values, uint8_t const * status, uint64_t const * times_ns,
+			   std::vector<size_t> const * subset) const {
+  size_t n = subset ? subset->size() : regs.size();
+  std::string nameData;
+  std::vector<uint32_t> addrs(n);
+  std::vector<uint32_t> masks(n);
+  for (size_t i = 0; i < n; i++) {
+    size_t iReg = subset ? (*subset)[i] : i;
+    nameData += names[iReg];
+    nameData.push_back('\0');
+    addrs[i] = regs[iReg].addr;
+    masks[i] = regs[iReg].mask;
+  }
+
+  register_snapshot_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+  header.version = REGISTER_SNAPSHOT_VERSION;
+  header.header_size = sizeof(header);
+  header.registers = n;
+  header.snapshots = nSnapshots;
+  header.names_size = nameData.size();
+
+  char pid[32];
+  snprintf(pid, sizeof(pid), ".%d", getpid());
+  std::string tmpFile = fileName + pid;
+  FILE * out = fopen(tmpFile.c_str(), "wb");
+  if (out == NULL) {
+    fprintf(stderr, "failed to create %s\n", tmpFile.c_str());
+    return -1;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, out) == 1) &&
+            (fwrite(nameData.data(), 1, nameData.size(), out) == nameData.size()) &&
+            (fwrite(addrs.data(), sizeof(uint32_t), n, out) == n) &&
+            (fwrite(masks.data(), sizeof(uint32_t), n, out) == n) &&
+            (fwrite(times_ns, sizeof(uint64_t), nSnapshots, out) == nSnapshots) &&
+            (fwrite(values, sizeof(uint32_t), n*nSnapshots, out) == n*nSnapshots) &&
+            (fwrite(status, sizeof(uint8_t), n*nSnapshots, out) == n*nSnapshots);
+  ok = (fclose(out) == 0) && ok;
+  if (!ok || rename(tmpFile.c_str(), fileName.c_str()) != 0) {
+    fprintf(stderr, "failed to write %s\n", fileName.c_str());
+    unlink(tmpFile.c_str());
+    return -1;
+  }
+  return 0;
+}
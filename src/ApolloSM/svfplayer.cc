@@ -1,9 +1,11 @@
 #include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/ApolloSM_Exceptions.hh>
 #include "ApolloSM/svfplayer.hh"
 //#include <../../butool-ipbus-herlpers/include/IPBusRegHelper/IPBusRegHelper.hh>
 #include <stdio.h>
 #include <string>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
@@ -15,6 +17,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sched.h>
  
 /*DEBUGGING*/
 #define DEBUG
@@ -23,35 +26,182 @@ int counter = 0;
 int lines = 32;
 #endif
 
-//Defining variables for AXI
-uint32_t tms32, tdi32, length32, tdo32;
-int tmsval, tdival, indx;
+//Compares a captured TDO word against the expected data, only bits set in mask are checked
+void SVFPlayer::check_tdo(uint32_t tdo, uint32_t expected, uint32_t mask, uint64_t firstTCK) {
+  bitcount_tdo += __builtin_popcount(mask);
+  uint32_t diff = (tdo ^ expected) & mask;
+  if (!diff) {
+    return;
+  }
+  tdo_errors++;
+  while (diff) {
+    int bit = __builtin_ctz(diff);
+    uint64_t tck = firstTCK + bit;
+    //find the scan this bit belongs to
+    size_t iScan = 0;
+    while (iScan < tdo_scans.size() &&
+	   !(tck >= tdo_scans[iScan].first_tck && tck < tdo_scans[iScan].first_tck + tdo_scans[iScan].len)) {
+      iScan++;
+    }
+    if (iScan < tdo_scans.size()) {
+      fprintf(stderr, "TDO mismatch at TCK %llu: bit %llu of the scan in SVF command %d, expected %u got %u\n",
+	      (unsigned long long) tck,
+	      (unsigned long long) (tck - tdo_scans[iScan].first_tck),
+	      tdo_scans[iScan].command,
+	      (expected >> bit) & 0x1, (tdo >> bit) & 0x1);
+    } else {
+      fprintf(stderr, "TDO mismatch at TCK %llu, expected %u got %u\n",
+	      (unsigned long long) tck, (expected >> bit) & 0x1, (tdo >> bit) & 0x1);
+    }
+    diff &= diff - 1;
+  }
+}
 
-void SVFPlayer::tck() {
-  //write tms & tdi, then update length
-  tms32 ^= (-tmsval ^ tms32) & (1UL << indx);
-  tdi32 ^= (-tdival ^ tdi32) & (1UL << indx);
-  length32 = indx + 1;
-
-  //if tms and tdi full
-  if(indx == 31) {
-    
+//Drops the scans whose bits have all been verified
+void SVFPlayer::retire_tdo_scans() {
+  size_t done = 0;
+  while (done < tdo_scans.size() &&
+	 tdo_scans[done].first_tck + tdo_scans[done].len <= io_tck) {
+    done++;
+  }
+  if (done > 0) {
+    tdo_scans.erase(tdo_scans.begin(), tdo_scans.begin() + done);
+  }
+}
+
+//Waits until the core clears GO, spinning or on the core's interrupt (see SetIRQ)
+void SVFPlayer::wait_go() {
+  uint64_t start = monotonic_ns();
+  uint64_t sleeps = irq.Sleeps();
+  irq.WaitFor([this]() {
+      stats.reads++;
+      stats.dispatches++;
+      //the bus is free between polls, other chains use it while this core shifts
+      std::unique_lock<std::mutex> bus = bus_lock();
+      return RegReadNode(*nGO) != 0;
+    });
+  stats.irq_sleeps += irq.Sleeps() - sleeps;
+  poll_ns += monotonic_ns() - start;
+}
+
+//Shifts a word through the mapped registers (see SetMock)
+void SVFPlayer::send_word_direct(jtag_word const & word) {
+  axi_jtag_regs volatile * regs = direct_regs;
+  uint64_t start = monotonic_ns();
+  {
+    std::unique_lock<std::mutex> bus = bus_lock();
+    regs->length = word.length;
+    regs->tms = word.tms;
+    regs->tdi = word.tdi;
+    //the register file is ordinary shared memory, publish the vectors before GO
+    __sync_synchronize();
+    regs->ctrl = 1;
+  }
+  stats.writes += 4;
+
+  uint64_t pollStart = monotonic_ns();
+  uint64_t sleeps = irq.Sleeps();
+  irq.WaitFor([this, regs]() {
+      stats.reads++;
+      if (regs->ctrl == 0) {
+	return false;
+      }
+      //whatever serves the file may share our CPU
+      sched_yield();
+      return true;
+    });
+  stats.irq_sleeps += irq.Sleeps() - sleeps;
+  poll_ns += monotonic_ns() - pollStart;
+  __sync_synchronize();
+
+  uint32_t tdo = 0;
+  if (word.tdo_mask) {
+    std::unique_lock<std::mutex> bus = bus_lock();
+    tdo = regs->tdo;
+    stats.reads++;
+  }
+  bus_ns += monotonic_ns() - start;
+  if (word.tdo_mask) {
+    check_tdo(tdo, word.tdo, word.tdo_mask, word.first_tck);
+  }
+}
+
+//Hands the buffered word to the bus side, on the I/O thread if the pipeline runs
+void SVFPlayer::flush() {
+  if (recording) {
+    record_word(length32, tms32, tdi32, tdo32, mask32);
+  }
+  if (!compile_only) {
+    jtag_word word = {JTAG_WORD, length32, tms32, tdi32, tdo32, mask32, word_tck};
+    if (pipelined) {
+      ring_push(word);
+    } else {
+      bool parsing = parse_pause();
+      send_word(word);
+      parse_resume(parsing);
+    }
+  }
+  word_tck += length32;
+
+  //reset local registers
+  length32 = 0UL;
+  tms32 = 0UL;
+  tdi32 = 0UL;
+  tdo32 = 0UL;
+  mask32 = 0UL;
+  //reset indx
+  indx = 0;
+}
+
+//Sends a word to the AXI JTAG core
+void SVFPlayer::send_word(jtag_word const & word) {
+  stats.words++;
+  if (direct_regs != NULL) {
+    send_word_direct(word);
+  } else if (batch_words > 1) {
+    //the bus transactions go out in dispatch_words()
+    pending_word pending;
+    pending.length = word.length;
+    pending.tms = word.tms;
+    pending.tdi = word.tdi;
+    pending.tdo_expected = word.tdo;
+    pending.tdo_mask = word.tdo_mask;
+    pending.first_tck = word.first_tck;
+    pending_words.push_back(pending);
+    stats.writes += 4;
+    //a core that is still shifting drops a new word, so unless it buffers them
+    //(no GO poll reads) every word has to finish before the next one is written
+    if (poll_reads > 0 || word.tdo_mask || pending_words.size() >= batch_words) {
+      dispatch_words();
+    }
+  } else {
     //assign registers
-    RegWriteNode(*nLength, length32);
-    RegWriteNode(*nTMS, tms32);
-    RegWriteNode(*nTDI, tdi32);
-    RegWriteNode(*nGO, 1UL);
+    uint64_t start = monotonic_ns();
+    {
+      std::unique_lock<std::mutex> bus = bus_lock();
+      RegWriteNode(*nLength, word.length);
+      RegWriteNode(*nTMS, word.tms);
+      RegWriteNode(*nTDI, word.tdi);
+      RegWriteNode(*nGO, 1UL);
+    }
+    stats.writes += 4;
+    stats.dispatches += 4;
 
     //wait for read
-    while(RegReadNode(*nGO)) {}
-    
-    //reset local registers
-    length32 = 0UL;
-    tms32 = 0UL;
-    tdi32 = 0UL;
-    //reset indx
-    indx = 0;
-  } else {indx++;}
+    wait_go();
+
+    uint32_t tdo = 0;
+    if (word.tdo_mask) {
+      std::unique_lock<std::mutex> bus = bus_lock();
+      tdo = RegReadNode(*nTDO);
+      stats.reads++;
+      stats.dispatches++;
+    }
+    bus_ns += monotonic_ns() - start;
+    if (word.tdo_mask) {
+      check_tdo(tdo, word.tdo, word.tdo_mask, word.first_tck);
+    }
+  }
 
   //Debugging
 #ifndef DEBUG
@@ -61,92 +211,424 @@ void SVFPlayer::tck() {
     //print tdi
     fprintf(stderr, "_tdi_");
     for (int run = 0; run < 32; ++run) {
-      if (tdi32 >> run & 0x1) fprintf(stderr, "1");
+      if (word.tdi >> run & 0x1) fprintf(stderr, "1");
       else fprintf(stderr, "0");
     }
     fprintf(stderr, "\n");
     //print tms
     fprintf(stderr, "_tms_");
     for (int run = 0; run < 32; ++run) {
-      if (tms32 >> run & 0x1) fprintf(stderr, "1");
+      if (word.tms >> run & 0x1) fprintf(stderr, "1");
       else fprintf(stderr, "0");
     }
     fprintf(stderr, "\n");
   }
 #endif
+
+  io_tck = word.first_tck + word.length;
+  progress_tcks.store(io_tck, std::memory_order_relaxed);
+  if (pending_words.empty()) {
+    retire_tdo_scans();
+  }
+  if (progress_callback != NULL && (stats.words & 0xFF) == 0) {
+    report_progress();
+  }
+}
+
+//Registers a scan whose TDO is checked, so mismatches can be traced back to it
+void SVFPlayer::add_tdo_scan(uint64_t firstTCK, int len, int command) {
+  if (compile_only) {
+    return;
+  }
+  if (pipelined) {
+    jtag_word word = {JTAG_SCAN, (uint32_t) len, (uint32_t) command, 0, 0, 0, firstTCK};
+    ring_push(word);
+  } else {
+    tdo_scan scan = {firstTCK, len, command};
+    tdo_scans.push_back(scan);
+  }
+}
+
+//Sends the queued words in one dispatch and waits until the core is done with them.
+//With GO poll reads there is one word, its GO and TDO reads share its dispatch and
+//only a word that takes longer than those reads needs more polling.
+void SVFPlayer::dispatch_words() {
+  if (pending_words.empty()) {
+    return;
+  }
+  uint64_t start = monotonic_ns();
+  {
+    //uHAL queues the transactions of every thread together, nothing else may
+    //queue or dispatch between our first write and our dispatch
+    std::unique_lock<std::mutex> bus = bus_lock();
+    for (size_t i = 0; i < pending_words.size(); i++) {
+      pending_word & pending = pending_words[i];
+      nLength->write(pending.length);
+      nTMS->write(pending.tms);
+      nTDI->write(pending.tdi);
+      nGO->write(1UL);
+      for (size_t iRead = 0; iRead < poll_reads; iRead++) {
+	pending.go = nGO->read();
+      }
+      stats.reads += poll_reads;
+      if (poll_reads > 0 && pending.tdo_mask) {
+	pending.tdo = nTDO->read();
+	stats.reads++;
+      }
+    }
+    (*hwInterface)->dispatch();
+  }
+  stats.dispatches++;
+
+  //only the last word can be checked, a word with TDO checks is always dispatched last
+  pending_word const & last = pending_words.back();
+  bool busy = (poll_reads == 0) || last.go.value() != 0;
+  if (busy) {
+    wait_go();
+  }
+  if (last.tdo_mask) {
+    uint32_t tdo;
+    if (busy) {
+      //the queued TDO read was too early or never queued, read it now
+      std::unique_lock<std::mutex> bus = bus_lock();
+      tdo = RegReadNode(*nTDO);
+      stats.reads++;
+      stats.dispatches++;
+    } else {
+      tdo = last.tdo.value();
+    }
+    check_tdo(tdo, last.tdo_expected, last.tdo_mask, last.first_tck);
+  }
+  bus_ns += monotonic_ns() - start;
+  pending_words.clear();
+  retire_tdo_scans();
+}
+
+//Holds the shared bus mutex, if there is one, for one bus transaction or dispatch.
+//Released by the destructor, so an exception from uHAL can't leave it locked.
+std::unique_lock<std::mutex> SVFPlayer::bus_lock() {
+  if (bus_mutex == NULL) {
+    return std::unique_lock<std::mutex>();
+  }
+  return std::unique_lock<std::mutex>(*bus_mutex);
+}
+
+void SVFPlayer::SetBusMutex(std::mutex * busMutex) {
+  bus_mutex = busMutex;
+}
+
+//Fraction of the file played
+double SVFPlayer::Progress() const {
+  size_t total = progress_total.load(std::memory_order_relaxed);
+  if (total == 0) {
+    return 0;
+  }
+  return double(progress_bytes.load(std::memory_order_relaxed)) / total;
+}
+
+uint64_t SVFPlayer::TCKs() const {
+  return progress_tcks.load(std::memory_order_relaxed);
+}
+
+void SVFPlayer::reset_stats() {
+  stats = SVFStats();
+  start_ns = monotonic_ns();
+  stop_ns = 0;
+  bus_ns = 0;
+  poll_ns = 0;
+  delay_ns = 0;
+  parse_ns = 0;
+  parse_running = false;
+  progress_next_ns = start_ns + progress_interval_ns;
+}
+
+SVFStats SVFPlayer::Stats() const {
+  SVFStats ret = stats;
+  ret.tcks = TCKs();
+  ret.tdi_bits = bitcount_tdi;
+  ret.tdo_bits = bitcount_tdo;
+  ret.tdo_errors = tdo_errors;
+  ret.total_seconds = 1E-9*((stop_ns ? stop_ns : monotonic_ns()) - start_ns);
+  ret.bus_seconds = 1E-9*bus_ns;
+  ret.poll_seconds = 1E-9*poll_ns;
+  ret.delay_seconds = 1E-9*delay_ns;
+  ret.parse_seconds = 1E-9*parse_ns.load(std::memory_order_relaxed);
+  ret.progress = Progress();
+  return ret;
+}
+
+//Stops the parse clock while the parsing thread waits on the bus, a RUNTEST or the
+//I/O thread.  Returns whether it was running, to be handed to parse_resume().
+bool SVFPlayer::parse_pause() {
+  if (!parse_running) {
+    return false;
+  }
+  parse_ns.fetch_add(monotonic_ns() - parse_mark, std::memory_order_relaxed);
+  parse_running = false;
+  return true;
+}
+
+void SVFPlayer::parse_resume(bool paused) {
+  if (paused) {
+    parse_mark = monotonic_ns();
+    parse_running = true;
+  }
+}
+
+void SVFPlayer::SetProgressCallback(SVFProgressCallback progress, void * data, double interval) {
+  progress_callback = progress;
+  progress_data = data;
+  progress_interval_ns = interval * 1E9;
+}
+
+void SVFPlayer::report_progress() {
+  uint64_t now = monotonic_ns();
+  if (now < progress_next_ns) {
+    return;
+  }
+  progress_next_ns = now + progress_interval_ns;
+  (*progress_callback)(Stats(), progress_data);
+}
+
+int SVFPlayer::SetIRQ(std::string const & uioDevice, uint32_t spinUsecs) {
+  irq.SetSpin(spinUsecs);
+  if (uioDevice.empty()) {
+    irq.Close();
+    return 0;
+  }
+  return irq.Open(uioDevice);
+}
+
+void SVFPlayer::SetBatch(size_t words, size_t pollReads) {
+  batch_words = words;
+  poll_reads = pollReads;
+  pending_words.reserve(batch_words);
+}
+
+//Appends nbits (1-32) of tms & tdi, LSB is shifted first.
+//Bits set in tdoMask are checked against tdo once the word is read back.
+void SVFPlayer::shift_word(uint32_t tms, uint32_t tdi, uint32_t tdo, uint32_t tdoMask, int nbits) {
+  if (nbits < 32) {
+    uint32_t mask = (1UL << nbits) - 1;
+    tms &= mask;
+    tdi &= mask;
+    tdoMask &= mask;
+  }
+  tdo &= tdoMask;
+  //TDI holds the last shifted bit during the following TAP moves
+  tdival = (tdi >> (nbits - 1)) & 0x1;
+  tms32 |= tms << indx;
+  tdi32 |= tdi << indx;
+  tdo32 |= tdo << indx;
+  mask32 |= tdoMask << indx;
+
+  int fill = indx + nbits;
+  if (fill >= 32) {
+    //tms and tdi full
+    length32 = 32;
+    flush();
+    //carry the bits that didn't fit into the next word
+    fill -= 32;
+    if (fill > 0) {
+      tms32 = tms >> (nbits - fill);
+      tdi32 = tdi >> (nbits - fill);
+      tdo32 = tdo >> (nbits - fill);
+      mask32 = tdoMask >> (nbits - fill);
+    }
+  }
+  indx = fill;
+  length32 = indx;
+}
+
+//Sends a partly filled word
+void SVFPlayer::flush_partial() {
+  if (indx > 0) {
+    flush();
+  }
+}
+
+//Sends one whole word of a compiled program, the buffer must be empty
+void SVFPlayer::load_word(int length, uint32_t tms, uint32_t tdi, uint32_t tdo, uint32_t tdoMask) {
+  length32 = length;
+  tms32 = tms;
+  tdi32 = tdi;
+  tdo32 = tdo & tdoMask;
+  mask32 = tdoMask;
+  flush();
+}
+
+void SVFPlayer::tck() {
+  shift_word(tmsval, tdival, 0, 0, 1);
+}
+
+//TCKs shifted so far, including the ones still buffered
+uint64_t SVFPlayer::shifted_tcks() {
+  return word_tck + indx;
 }
 
 //Empty definitions,
-static int io_tdo() {return -1;}
 void SVFPlayer::pulse_sck() {}
 void SVFPlayer::set_trst(int v) {if ((v * 0)==1){fprintf(stderr,"null");} }
 int SVFPlayer::set_frequency(int v) {return (v * 0);}
 
 int SVFPlayer::setup(std::string const & XVCReg) {
 
+  if (direct_regs != NULL) {
+    //a register file, there are no nodes
+    fprintf(stderr, "playing into a JTAG register file\n");
+    reset_words();
+    return 0;
+  }
+
   //Setting nodes
   nTDI = &GetNode(XVCReg+".TDI_VECTOR");
   nTDO = &GetNode(XVCReg+".TDO_VECTOR");
   nTMS = &GetNode(XVCReg+".TMS_VECTOR");
   nLength = &GetNode(XVCReg+".LENGTH");
   nGO = &GetNode(XVCReg+".GO");
-  
-  //Setting up AXI
+
+  reset_words();
+  return 0;
+}
+
+//Clears the word buffer and the TDO bookkeeping
+void SVFPlayer::reset_words() {
   tms32 = 0UL;
   tdi32 = 0UL;
   length32 = 0UL;
   tdo32 = 0UL;
+  mask32 = 0UL;
   tmsval = 0;
   tdival = 0;
   indx = 0;
-  return 0;
+  word_tck = 0;
+  io_tck = 0;
+  tdo_errors = 0;
+  tdo_scans.clear();
+  pending_words.clear();
 }
 
 int SVFPlayer::shutdown() {
 
-  
-  //assign registers
-  RegWriteNode(*nLength, length32);
-  RegWriteNode(*nTMS, tms32);
-  RegWriteNode(*nTDI, tdi32);
-  RegWriteNode(*nGO, 1);
-  
-  //wait for read
-  while(RegReadNode(*nGO)) {}
+  //send whatever is left in the buffer
+  flush_partial();
+  if (pipelined) {
+    pipeline_stop();
+  } else {
+    dispatch_words();
+  }
   
   //reset local registers
-  length32 = 0UL;
-  tms32 = 0UL;
-  tdi32 = 0UL;
   tmsval = 0;
   tdival =0;
-  indx = 0;
   return 0;
 }
 
-//runs a few times
+//Clocks num_tck idle TCKs with TMS held at tms, then waits until usecs have passed.
+//The idle TCKs are packed into words like any other shift, so with batching they go out
+//in the same dispatch as the words queued before them. The wait is measured from the end
+//of that dispatch and sleeps on CLOCK_MONOTONIC, so it is never short.
 void SVFPlayer::udelay(long usecs, int tms, long num_tck) {
-  if (num_tck > 0) {
-    struct timeval tv1, tv2;
-    gettimeofday(&tv1, NULL);
-    tmsval = !! tms;
-    while (num_tck > 0) {
-      tck();
-      num_tck--;
-    }
-    gettimeofday(&tv2, NULL);
-    if (tv2.tv_sec > tv1.tv_sec) {
-      usecs -= (1000000 - tv1.tv_usec) + (tv2.tv_usec - tv1.tv_sec - 1) * 1000000;
-      tv1.tv_usec = 0;
+  tmsval = !! tms;
+  uint32_t tmsWord = tmsval ? 0xFFFFFFFF : 0;
+  uint32_t tdiWord = tdival ? 0xFFFFFFFF : 0;
+  while (num_tck > 0) {
+    int nbits = (num_tck > 32) ? 32 : num_tck;
+    shift_word(tmsWord, tdiWord, 0, 0, nbits);
+    num_tck -= nbits;
+  }
+  if (usecs <= 0) {
+    //nothing to wait for, the idle words can share a dispatch with what comes next
+    return;
+  }
+
+  //everything before the wait has to reach the core
+  flush_partial();
+  if (recording) {
+    record_delay(usecs);
+  }
+  if (compile_only) {
+    return;
+  }
+  if (pipelined) {
+    jtag_word word = {JTAG_DELAY, 0, 0, 0, 0, 0, (uint64_t) usecs};
+    ring_push(word);
+  } else {
+    bool parsing = parse_pause();
+    wait_delay(usecs);
+    parse_resume(parsing);
+  }
+}
+
+//Sends the queued words, then sleeps until usecs after they are done
+void SVFPlayer::wait_delay(uint64_t usecs) {
+  dispatch_words();
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  uint64_t start = deadline.tv_sec * 1000000000ULL + deadline.tv_nsec;
+  deadline.tv_sec += usecs / 1000000;
+  deadline.tv_nsec += (usecs % 1000000) * 1000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  //an absolute deadline doesn't drift when a signal interrupts the sleep
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+  delay_ns += monotonic_ns() - start;
+}
+
+//Maps the SVF file read only, followed by at least one zero byte so the text is NUL terminated
+int SVFPlayer::map_file(std::string const & svfFile) {
+  int fd = open(svfFile.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open path\n");
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    fprintf(stderr, "failed to stat %s\n", svfFile.c_str());
+    close(fd);
+    return -1;
+  }
+  svf_size = st.st_size;
+
+  //reserve the file size plus a zero page, then map the file over the start of it
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  svf_map_size = (svf_size / pageSize + 1) * pageSize;
+  void * map = mmap(NULL, svf_map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == map) {
+    fprintf(stderr, "failed to map %s\n", svfFile.c_str());
+    close(fd);
+    return -1;
+  }
+  if (svf_size > 0) {
+    if (MAP_FAILED == mmap(map, svf_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)) {
+      fprintf(stderr, "failed to map %s\n", svfFile.c_str());
+      munmap(map, svf_map_size);
+      close(fd);
+      return -1;
     }
-    usecs -= tv2.tv_usec;
+    madvise(map, svf_size, MADV_SEQUENTIAL);
   }
-  if (usecs > 0) {usleep(usecs);}
+  close(fd);
+
+  svf_data = (const char *) map;
+  svf_next = svf_data;
+  progress_bytes.store(0, std::memory_order_relaxed);
+  progress_tcks.store(0, std::memory_order_relaxed);
+  progress_total.store(svf_size, std::memory_order_relaxed);
+  return 0;
 }
 
-//Runs for reading file
-int SVFPlayer::getbyte() {
-  return fgetc(f);
+void SVFPlayer::unmap_file() {
+  if (svf_data != NULL) {
+    munmap((void *) svf_data, svf_map_size);
+  }
+  svf_data = NULL;
+  svf_next = NULL;
+  svf_size = 0;
+  svf_map_size = 0;
 }
 
 //Main function for setting tms, tdi, and tck
@@ -159,16 +641,13 @@ int SVFPlayer::pulse_tck(int tms, int tdi, int tdo, int rmask, int sync) {
     bitcount_tdi++;
     tdival = !! tdi;
   }
-  //pulse tck
-  tck();
-  //read tdo
-  int line_tdo = io_tdo();
-  int rc = line_tdo >= 0 ? line_tdo : 0;
-  //interpret tdo
-  if (tdo >= 0 && line_tdo >= 0) {
-    bitcount_tdo++;
-    if (tdo != line_tdo) {rc = -1;}
+  //pulse tck, the tdo bit is checked when its word is read back
+  if (tdo >= 0) {
+    shift_word(tmsval, tdival, !! tdo, 1, 1);
+  } else {
+    tck();
   }
+  int rc = 0;
   //END
   return rc;
 }
@@ -182,38 +661,103 @@ int SVFPlayer::play(std::string const & svfFile , std::string const & XVCReg) {
   fprintf(stderr, "Lib(X)SVF is free software licensed under the ISC license.\n");  
   fprintf(stderr, "Modified for use in Apollo platform by Michael Kremer, kremerme@bu.edu\n\n"); //Mike
 
-  //open SVF file
-  f = fopen(svfFile.c_str(),"rb"); //swith to take path in
-  if (f == NULL) {fprintf(stderr, "failed to open path\n");}
-  else {fprintf(stderr, "playing %s\n", svfFile.c_str());}
+  //map SVF file, it is parsed in place
+  if (map_file(svfFile) < 0) {
+    return -1;
+  }
+  fprintf(stderr, "playing %s\n", svfFile.c_str());
 
   //set Tap State
   tap_state = LIBXSVF_TAP_INIT;
+  bitcount_tdi = 0;
+  bitcount_tdo = 0;
+  command_count = 0;
+  reset_stats();
 
   //Run setup
   if (setup(XVCReg) < 0) {
     fprintf(stderr, "Setup of JTAG interface failed.\n");
+    unmap_file();
     return -1;
   } else {fprintf(stderr, "JTAG setup succesful\n");}
 
-  //Run svf player
-  int rc = svf_reader();
-  tap_walk(LIBXSVF_TAP_RESET); //Reset tap
+  //Run svf player, or the words of a compiled program
+  int rc;
+  if (pipeline_words > 0) {
+    pipeline_start();
+  }
+  try {
+    parse_resume(true);
+    const svf_program_header *program = mapped_program();
+    if (program) {
+      rc = run_program(program);
+    } else {
+      rc = play_svf();
+    }
+    parse_pause();
+  } catch (...) {
+    parse_pause();
+    pipeline_abort();
+    unmap_file();
+    throw;
+  }
+  unmap_file();
   
   //Run shutdown
-  if (shutdown() < 0) {
+  int shutdownRC = shutdown();
+  stop_ns = monotonic_ns();
+  if (shutdownRC < 0) {
     fprintf(stderr, "Shutdown of JTAG interface failed.\n");
     return -1;
   } else {
     fprintf(stderr, "JTAG shtdown succesful.\n");
-#ifndef DEBUG
-    fprintf(stderr, "Ran %d significant tdi bits.\n", bitcount_tdi);
-    fprintf(stderr, "Recieved %d significant tdo bits.\n", bitcount_tdo);
-#endif
+    if (tdo_errors) {
+      fprintf(stderr, "%d TDO words did not match.\n", tdo_errors.load());
+      rc = -1;
+    }
+    SVFStats summary = Stats();
+    fprintf(stderr, "%llu TCKs in %llu words (%llu writes, %llu reads, %llu dispatches), %.3fs at %.3f MHz\n",
+	    (unsigned long long) summary.tcks, (unsigned long long) summary.words,
+	    (unsigned long long) summary.writes, (unsigned long long) summary.reads,
+	    (unsigned long long) summary.dispatches,
+	    summary.total_seconds, 1E-6*summary.TCKRate());
+    fprintf(stderr, "parsing %.3fs, bus %.3fs (GO polling %.3fs), RUNTEST waits %.3fs\n",
+	    summary.parse_seconds, summary.bus_seconds, summary.poll_seconds, summary.delay_seconds);
+    if (irq.IsOpen()) {
+      fprintf(stderr, "%llu GO waits slept on the interrupt\n", (unsigned long long) summary.irq_sleeps);
+    }
+    fprintf(stderr, "%llu significant TDI bits, %llu TDO bits checked\n",
+	    (unsigned long long) summary.tdi_bits, (unsigned long long) summary.tdo_bits);
   }
   return rc;
 }
 
-SVFPlayer::SVFPlayer(uhal::HwInterface * const * _hw): f(NULL), nTDI(NULL), nTDO(NULL), nTMS(NULL), nLength(NULL), nGO(NULL) {
+int SVFPlayer::SetMock(std::string const & regFile) {
+  axi_jtag_unmap_file(direct_regs);
+  direct_regs = NULL;
+  if (regFile.empty()) {
+    return 0;
+  }
+  direct_regs = axi_jtag_map_file(regFile);
+  return (direct_regs != NULL) ? 0 : -1;
+}
+
+SVFPlayer::SVFPlayer(uhal::HwInterface * const * _hw): tms32(0), tdi32(0), length32(0), tdo32(0), mask32(0), tmsval(0), tdival(0), indx(0),
+							svf_data(NULL), svf_next(NULL), svf_size(0), svf_map_size(0), per_bit(false), progress_bytes(0), progress_total(0), progress_tcks(0),
+							nTDI(NULL), nTDO(NULL), nTMS(NULL), nLength(NULL), nGO(NULL),
+							direct_regs(NULL), hwInterface(_hw), batch_words(1), poll_reads(1), bus_mutex(NULL),
+							recording(false), compile_only(false), pipeline_words(0), pipelined(false) {
+  memset(bit_buffers, 0, sizeof(bit_buffers));
+  progress_callback = NULL;
+  progress_data = NULL;
+  progress_interval_ns = 1000000000ULL;
+  reset_stats();
   SetHWInterface(_hw);  
 }
+
+SVFPlayer::~SVFPlayer() {
+  pipeline_abort();
+  bit_buffers_free();
+  unmap_file();
+  axi_jtag_unmap_file(direct_regs);
+}
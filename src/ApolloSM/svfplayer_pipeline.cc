@@ -0,0 +1,173 @@
+#include "ApolloSM/svfplayer.hh"
+#include <stdio.h>
+#include <thread>
+
+/*
+ * Parser / bus I/O pipeline
+ *
+ * With SetPipeline() the parsing thread (the one calling play()) only packs
+ * words; flush() pushes them into a single producer single consumer ring and
+ * an I/O thread sends them to the AXI JTAG core.  Everything on the bus side
+ * (batching, TDO checks, the scans they are reported against, statistics,
+ * RUNTEST waits and the progress callback) runs on the I/O thread.
+ *
+ * The ring is an spsc_ring, see spscRing.hh: a side that has to wait on the
+ * other spins for a short while and then sleeps until the other one wakes it.
+ */
+
+void SVFPlayer::SetPipeline(size_t ringWords)
+{
+  //round up to a power of two so the index wraps with a mask
+  size_t words = 0;
+  if (ringWords > 0) {
+    words = 2;
+    while (words < ringWords) {
+      words <<= 1;
+    }
+  }
+  pipeline_words = words;
+}
+
+void SVFPlayer::pipeline_start()
+{
+  ring.assign(pipeline_words, jtag_word());
+  ring_index.Reset();
+  ring_tail_cache = 0;
+  fences_sent = 0;
+  fences_done.store(0, std::memory_order_relaxed);
+  io_abort.store(false, std::memory_order_relaxed);
+  io_failed.store(false, std::memory_order_relaxed);
+  io_error = std::exception_ptr();
+  pipelined = true;
+  io_thread = std::thread(&SVFPlayer::io_loop, this);
+}
+
+//Adds an entry for the I/O thread, waits while the ring is full
+void SVFPlayer::ring_push(jtag_word const & word)
+{
+  size_t head = ring_index.head.load(std::memory_order_relaxed);
+  if (head - ring_tail_cache >= ring.size()) {
+    ring_tail_cache = ring_index.tail.load(std::memory_order_acquire);
+  }
+  if (head - ring_tail_cache >= ring.size()) {
+    //the ring is full, waiting on the I/O thread isn't parsing
+    bool parsing = parse_pause();
+    ring_index.ProducerWait([this, head]() {
+	ring_tail_cache = ring_index.tail.load(std::memory_order_acquire);
+	return head - ring_tail_cache < ring.size() || io_failed.load(std::memory_order_acquire);
+      });
+    parse_resume(parsing);
+    if (head - ring_tail_cache >= ring.size()) {
+      std::rethrow_exception(io_error);
+    }
+  }
+  ring[head & (ring.size() - 1)] = word;
+  ring_index.head.store(head + 1, std::memory_order_release);
+  ring_index.WakeConsumer();
+}
+
+void SVFPlayer::io_loop()
+{
+  size_t mask = ring.size() - 1;
+  size_t tail = ring_index.tail.load(std::memory_order_relaxed);
+  size_t head = tail;
+  try {
+    while (!io_abort.load(std::memory_order_relaxed)) {
+      if (tail == head) {
+	head = ring_index.head.load(std::memory_order_acquire);
+	if (tail == head) {
+	  //the parser is behind, don't leave batched words waiting on it
+	  dispatch_words();
+	  ring_index.ConsumerWait([this, tail, &head]() {
+	      head = ring_index.head.load(std::memory_order_acquire);
+	      return tail != head || io_abort.load(std::memory_order_relaxed);
+	    });
+	  continue;
+	}
+      }
+      jtag_word const & word = ring[tail & mask];
+      switch (word.type) {
+      case JTAG_WORD:
+	send_word(word);
+	break;
+      case JTAG_SCAN:
+	{
+	  tdo_scan scan = {word.first_tck, (int) word.length, (int) word.tms};
+	  tdo_scans.push_back(scan);
+	}
+	break;
+      case JTAG_DELAY:
+	wait_delay(word.first_tck);
+	break;
+      case JTAG_FENCE:
+	dispatch_words();
+	fences_done.fetch_add(1, std::memory_order_release);
+	break;
+      case JTAG_END:
+	dispatch_words();
+	ring_index.tail.store(tail + 1, std::memory_order_release);
+	return;
+      }
+      tail++;
+      ring_index.tail.store(tail, std::memory_order_release);
+      ring_index.WakeProducer();
+    }
+  } catch (...) {
+    io_error = std::current_exception();
+    io_failed.store(true, std::memory_order_release);
+    ring_index.WakeProducer();
+  }
+}
+
+//Waits until the I/O thread has sent and checked everything pushed so far
+void SVFPlayer::pipeline_drain()
+{
+  if (!pipelined) {
+    return;
+  }
+  jtag_word fence = {JTAG_FENCE, 0, 0, 0, 0, 0, 0};
+  ring_push(fence);
+  fences_sent++;
+  bool parsing = parse_pause();
+  ring_index.ProducerWait([this]() {
+      return fences_done.load(std::memory_order_acquire) >= fences_sent ||
+	io_failed.load(std::memory_order_acquire);
+    });
+  parse_resume(parsing);
+  if (fences_done.load(std::memory_order_acquire) < fences_sent) {
+    std::rethrow_exception(io_error);
+  }
+}
+
+//Lets the I/O thread finish the ring, rethrows anything it threw
+void SVFPlayer::pipeline_stop()
+{
+  if (!pipelined) {
+    return;
+  }
+  if (!io_failed.load(std::memory_order_acquire)) {
+    jtag_word end = {JTAG_END, 0, 0, 0, 0, 0, 0};
+    try {
+      ring_push(end);
+    } catch (...) {
+      //the I/O thread failed while we waited, its exception is rethrown below
+    }
+  }
+  io_thread.join();
+  pipelined = false;
+  if (io_failed.load(std::memory_order_acquire)) {
+    std::rethrow_exception(io_error);
+  }
+}
+
+//Stops the I/O thread without sending the rest of the ring
+void SVFPlayer::pipeline_abort()
+{
+  if (!pipelined) {
+    return;
+  }
+  io_abort.store(true, std::memory_order_relaxed);
+  ring_index.WakeConsumer();
+  io_thread.join();
+  pipelined = false;
+}
@@ -0,0 +1,300 @@
+#include "ApolloSM/svfplayer.hh"
+#include <unistd.h>
+#include <string>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+/*
+ * Compiled SVF programs
+ *
+ * A program is the stream of AXI JTAG words an SVF file produces, so tap_walk
+ * transitions and scan padding are already resolved into the TMS/TDI words.
+ * After the svf_program_header the file is a list of uint32_t ops:
+ *   SVF_OP_SHIFT     nbits, then ceil(nbits/32) x {tms, tdi}
+ *   SVF_OP_SHIFT_TDO nbits, then ceil(nbits/32) x {tms, tdi, tdo, tdo mask}
+ *   SVF_OP_DELAY     usecs, the RUNTEST wait after the words before it
+ *   SVF_OP_END
+ * The op code sits in the top 8 bits of the op word.  Every word of a shift op
+ * is 32 bits long except the last, which holds nbits%32 bits if non-zero.
+ */
+
+static const char programMagic[8] = {'A','P','O','L','L','O','J','P'};
+
+//FNV-1a style hash over 64bit words, folded so the high bits reach the low ones
+static uint64_t content_hash(const char *data, size_t size)
+{
+  const uint64_t prime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, &data[i], 8);
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ (unsigned char) data[i]) * prime;
+  }
+  hash = (hash ^ size) * prime;
+  return hash ^ (hash >> 32);
+}
+
+//Checks that the buffer holds a complete program
+static const svf_program_header * program_header(const char *data, size_t size)
+{
+  if (size < sizeof(svf_program_header)) {
+    return NULL;
+  }
+  const svf_program_header *header = (const svf_program_header *) data;
+  if (memcmp(header->magic, programMagic, sizeof(programMagic)) != 0) {
+    return NULL;
+  }
+  if (header->version != SVF_PROGRAM_VERSION ||
+      header->header_size != sizeof(svf_program_header) ||
+      header->header_size + header->op_words * sizeof(uint32_t) != size) {
+    fprintf(stderr, "Compiled SVF program is corrupt or from another version.\n");
+    return NULL;
+  }
+  return header;
+}
+
+void SVFPlayer::record_start()
+{
+  program_ops.clear();
+  program_run = 0;
+  program_run_op = SVF_OP_END;
+  recording = true;
+}
+
+//Appends one flushed word to the program
+void SVFPlayer::record_word(int length, uint32_t tms, uint32_t tdi, uint32_t tdo, uint32_t tdoMask)
+{
+  uint32_t op = tdoMask ? SVF_OP_SHIFT_TDO : SVF_OP_SHIFT;
+  if (op != program_run_op ||
+      program_ops[program_run + 1] > 0xFFFFFFFF - (uint32_t) length) {
+    //start a new run, also when the bit count of this one would wrap
+    program_run = program_ops.size();
+    program_run_op = op;
+    program_ops.push_back(op << 24);
+    program_ops.push_back(0);
+  }
+  program_ops[program_run + 1] += length;
+  program_ops.push_back(tms);
+  program_ops.push_back(tdi);
+  if (op == SVF_OP_SHIFT_TDO) {
+    program_ops.push_back(tdo);
+    program_ops.push_back(tdoMask);
+  }
+  if (length < 32) {
+    //only the last word of a run may be short
+    program_run_op = SVF_OP_END;
+  }
+}
+
+//Appends a RUNTEST wait, the words after it start a new run
+void SVFPlayer::record_delay(long usecs)
+{
+  program_ops.push_back(SVF_OP_DELAY << 24);
+  program_ops.push_back(usecs > 0xFFFFFFFF ? 0xFFFFFFFF : usecs);
+  program_run_op = SVF_OP_END;
+}
+
+void SVFPlayer::record_stop()
+{
+  program_ops.push_back(SVF_OP_END << 24);
+  recording = false;
+}
+
+//Writes the recorded program, through a temporary file so readers never see half of it
+int SVFPlayer::record_save(std::string const & programFile, uint64_t sourceHash, uint64_t sourceSize)
+{
+  svf_program_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, programMagic, sizeof(programMagic));
+  header.version = SVF_PROGRAM_VERSION;
+  header.header_size = sizeof(header);
+  header.source_hash = sourceHash;
+  header.source_size = sourceSize;
+  header.tck_count = word_tck;
+  header.tdi_bits = bitcount_tdi;
+  header.op_words = program_ops.size();
+
+  char pid[32];
+  snprintf(pid, sizeof(pid), ".%d", getpid());
+  std::string tmpFile = programFile + pid;
+  FILE *out = fopen(tmpFile.c_str(), "wb");
+  if (out == NULL) {
+    fprintf(stderr, "failed to create %s\n", tmpFile.c_str());
+    return -1;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, out) == 1) &&
+            (fwrite(&program_ops[0], sizeof(uint32_t), program_ops.size(), out) == program_ops.size());
+  ok = (fclose(out) == 0) && ok;
+  if (!ok || rename(tmpFile.c_str(), programFile.c_str()) != 0) {
+    fprintf(stderr, "failed to write %s\n", programFile.c_str());
+    unlink(tmpFile.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+//Plays the words of a program through the normal flush path
+int SVFPlayer::run_program(const svf_program_header *header)
+{
+  const uint32_t *ops = (const uint32_t *) (((const char *) header) + header->header_size);
+  size_t nops = header->op_words;
+  size_t i = 0;
+  while (i < nops) {
+    progress_bytes.store(header->header_size + i * sizeof(uint32_t), std::memory_order_relaxed);
+    uint32_t op = ops[i] >> 24;
+    if (op == SVF_OP_END) {
+      progress_bytes.store(progress_total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      tap_state = LIBXSVF_TAP_RESET;
+      bitcount_tdi = header->tdi_bits;
+      pipeline_drain();
+      return tdo_errors ? -1 : 0;
+    }
+    if ((op != SVF_OP_SHIFT && op != SVF_OP_SHIFT_TDO && op != SVF_OP_DELAY) || (i + 2) > nops) {
+      break;
+    }
+    if (op == SVF_OP_DELAY) {
+      udelay(ops[i+1], 0, 0);
+      i += 2;
+      continue;
+    }
+    uint32_t nbits = ops[i+1];
+    size_t stride = (op == SVF_OP_SHIFT_TDO) ? 4 : 2;
+    size_t nwords = ((size_t) nbits + 31) / 32;
+    i += 2;
+    if (i + nwords * stride > nops) {
+      break;
+    }
+    for (size_t iWord = 0; iWord < nwords; iWord++, i += stride) {
+      int length = (iWord + 1 == nwords && (nbits & 0x1F)) ? (nbits & 0x1F) : 32;
+      if ((iWord & 0x3FF) == 0x3FF) {
+	progress_bytes.store(header->header_size + i * sizeof(uint32_t), std::memory_order_relaxed);
+      }
+      if (stride == 4) {
+	load_word(length, ops[i], ops[i+1], ops[i+2], ops[i+3]);
+      } else {
+	load_word(length, ops[i], ops[i+1], 0, 0);
+      }
+    }
+  }
+  fprintf(stderr, "Compiled SVF program is truncated at op %zu.\n", i);
+  return -1;
+}
+
+//Plays the mapped SVF text, through the program cache if one is set
+int SVFPlayer::play_svf()
+{
+  if (cache_dir.empty()) {
+    int rc = svf_reader();
+    tap_walk(LIBXSVF_TAP_RESET); //Reset tap
+    return rc;
+  }
+
+  uint64_t hash = content_hash(svf_data, svf_size);
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.svfc", (unsigned long long) hash);
+  std::string programFile = cache_dir + name;
+
+  //cache hit
+  int fd = open(programFile.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (MAP_FAILED != map) {
+      const svf_program_header *header = program_header((const char *) map, st.st_size);
+      int rc = 1;
+      if (header && header->source_hash == hash && header->source_size == svf_size) {
+	fprintf(stderr, "using compiled program %s\n", programFile.c_str());
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	rc = run_program(header);
+      }
+      munmap(map, st.st_size);
+      if (rc <= 0) {
+	return rc;
+      }
+    }
+  }
+
+  //cache miss, record the words while playing and keep them if the playback was good
+  record_start();
+  int rc = svf_reader();
+  tap_walk(LIBXSVF_TAP_RESET); //Reset tap
+  flush_partial();
+  record_stop();
+  //every word has to be checked before the program is kept
+  pipeline_drain();
+  if (rc == 0 && tdo_errors == 0) {
+    mkdir(cache_dir.c_str(), 0755);
+    if (record_save(programFile, hash, svf_size) == 0) {
+      fprintf(stderr, "cached compiled program %s\n", programFile.c_str());
+    }
+  }
+  program_ops.clear();
+  return rc;
+}
+
+int SVFPlayer::compile(std::string const & svfFile, std::string const & programFile)
+{
+  if (map_file(svfFile) < 0) {
+    return -1;
+  }
+  if (program_header(svf_data, svf_size)) {
+    fprintf(stderr, "%s is already compiled\n", svfFile.c_str());
+    unmap_file();
+    return -1;
+  }
+
+  //no bus access, the words are only recorded
+  compile_only = true;
+  tap_state = LIBXSVF_TAP_INIT;
+  bitcount_tdi = 0;
+  bitcount_tdo = 0;
+  command_count = 0;
+  reset_words();
+  reset_stats();
+
+  record_start();
+  int rc = svf_reader();
+  tap_walk(LIBXSVF_TAP_RESET); //Reset tap
+  flush_partial();
+  record_stop();
+  if (rc == 0) {
+    rc = record_save(programFile, content_hash(svf_data, svf_size), svf_size);
+  }
+  if (rc == 0) {
+    fprintf(stderr, "compiled %s to %s (%llu TCKs, %zu bytes)\n",
+	    svfFile.c_str(), programFile.c_str(),
+	    (unsigned long long) word_tck,
+	    sizeof(svf_program_header) + program_ops.size() * sizeof(uint32_t));
+  }
+  program_ops.clear();
+  compile_only = false;
+  unmap_file();
+  return rc;
+}
+
+void SVFPlayer::SetCache(std::string const & cacheDir)
+{
+  cache_dir = cacheDir;
+}
+
+//Returns the program header if the mapped file is a compiled program
+const svf_program_header * SVFPlayer::mapped_program()
+{
+  return program_header(svf_data, svf_size);
+}
@@ -11,92 +11,87 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
 
 
-static int realloc_maxsize[LIBXSVF_MEM_NUM];
-static void *h_realloc(void *ptr, int size, enum libxsvf_mem which) {
-  if (size > realloc_maxsize[which]) {realloc_maxsize[which] = size;}
-  return realloc(ptr, size);
-}   
+//Returns arena buffer which with room for at least nwords, 64 byte aligned.
+//The buffers only grow, so commands of alternating lengths reuse them.
+uint32_t * SVFPlayer::bit_buffer(enum libxsvf_mem which, int nwords)
+{
+  bit_buffer_s *buffer = &bit_buffers[which];
+  if (buffer->data == NULL || (size_t) nwords > buffer->words) {
+    //whole cache lines, at least doubling
+    size_t words = ((size_t) nwords + 16) & ~((size_t) 15);
+    if (words < 2*buffer->words)
+      words = 2*buffer->words;
+    void *data = NULL;
+    if (posix_memalign(&data, 64, words * sizeof(uint32_t)) != 0)
+      return NULL;
+    free(buffer->data);
+    buffer->data = (uint32_t *) data;
+    buffer->words = words;
+  }
+  return buffer->data;
+}
 
-int SVFPlayer::read_command(char **buffer_p, int *len_p)
+void SVFPlayer::bit_buffers_free()
 {
-  char *buffer = *buffer_p;
-  int braket_mode = 0;
-  int len = *len_p;
-  int p = 0;
+  for (int i = 0; i < LIBXSVF_MEM_NUM; i++) {
+    free(bit_buffers[i].data);
+    bit_buffers[i].data = NULL;
+    bit_buffers[i].words = 0;
+  }
+}
 
-  while (1)
-    {
-      if (len < p+10) {
-	len = len < 64 ? 96 : len*2;
- 	buffer =(char *) h_realloc(buffer, len, LIBXSVF_MEM_SVF_COMMANDBUF);
-	*buffer_p = buffer;
-	*len_p = len;
-	if (!buffer) {
-	  fprintf(stderr, "Allocating memory failed.\n");
-	  return -1;
-	}
-      }
-      buffer[p] = 0;
+//Skips whitespace and comments ("!" or "//" to the end of the line) in the mapped file
+static const char * skip_space(const char *p)
+{
+  while (1) {
+    if (*p != 0 && (unsigned char) *p <= ' ') {
+      p++;
+    } else if (*p == '!' || (p[0] == '/' && p[1] == '/')) {
+      while (*p != 0 && *p != '\n' && *p != '\r')
+	p++;
+    } else {
+      return p;
+    }
+  }
+}
 
-      int ch = getbyte();
-      if (ch < 0) {
-      handle_eof:
-	if (p == 0)
-	  return 0;
-	fprintf(stderr, "Unexpected EOF.\n");
-	return -1;
-      }
-      if (ch <= ' ') {
-      insert_eol:
-	if (!braket_mode && p > 0 && buffer[p-1] != ' ')
-	  buffer[p++] = ' ';
-	continue;
-      }
-      if (ch == '!') {
-      skip_to_eol:
-	while (1) {
-	  ch = getbyte();
-	  if (ch < 0)
-	    goto handle_eof;
-	  if (ch < ' ' && ch != '\t')
-	    goto insert_eol;
-	}
-      }
-      if (ch == '/' && p > 0 && buffer[p-1] == '/') {
-	p--;
-	goto skip_to_eol;
-      }
-      if (ch == ';')
-	break;
-      if (ch == '(') {
-	if (!braket_mode && p > 0 && buffer[p-1] != ' ')
-	  buffer[p++] = ' ';
-	braket_mode++;
-      }
-      if (ch >= 'a' && ch <= 'z')
-	buffer[p++] = ch - ('a' - 'A');
-      else
-	buffer[p++] = ch;
-      if (ch == ')') {
-	braket_mode--;
-	if (!braket_mode)
-	  buffer[p++] = ' ';
-      }
+static inline int token_end(char ch)
+{
+  return (unsigned char) ch <= ' ' || ch == ';' || ch == '(' || ch == ')' || ch == '!' || ch == '/';
+}
+
+//Finds the start of the next command in the mapped file, the text is parsed in place
+int SVFPlayer::read_command(const char **command_p)
+{
+  const char *p = skip_space(svf_next);
+  progress_bytes.store(p - svf_data, std::memory_order_relaxed);
+  if (*p == 0) {
+    if (p - svf_data < (long) svf_size) {
+      fprintf(stderr, "Unexpected NUL in SVF file.\n");
+      return -1;
     }
+    return 0;
+  }
+  *command_p = p;
   return 1;
 }
 
+//Compares a token in the SVF text (any case) with an upper case keyword
 int strtokencmp(const char *str1, const char *str2)
 {
   int i = 0;
   while (1) {
-    if ((str1[i] == ' ' || str1[i] == 0) && (str2[i] == ' ' || str2[i] == 0))
+    char ch = token_end(str1[i]) ? 0 : str1[i];
+    if (ch >= 'a' && ch <= 'z')
+      ch -= ('a' - 'A');
+    if (ch == 0 && str2[i] == 0)
       return 0;
-    if (str1[i] < str2[i])
+    if (ch < str2[i])
       return -1;
-    if (str1[i] > str2[i])
+    if (ch > str2[i])
       return +1;
     i++;
   }
@@ -105,9 +100,8 @@ int strtokencmp(const char *str1, const char *str2)
 int strtokenskip(const char *str1)
 {
   int i = 0;
-  while (str1[i] != 0 && str1[i] != ' ') i++;
-  while (str1[i] == ' ') i++;
-  return i;
+  while (!token_end(str1[i])) i++;
+  return skip_space(str1 + i) - str1;
 }
 
 
@@ -136,23 +130,19 @@ int SVFPlayer::token2tapstate(const char *str1)
 
 struct bitdata_s {
   int len, alloced_len;
-  int alloced_bytes;
-  unsigned char *tdi_data;
-  unsigned char *tdi_mask;
-  unsigned char *tdo_data;
-  unsigned char *tdo_mask;
-  unsigned char *ret_mask;
+  int alloced_words;
+  /* bit n of the scan (n=0 is shifted first) is bit n%32 of word n/32 */
+  uint32_t *tdi_data;
+  uint32_t *tdi_mask;
+  uint32_t *tdo_data;
+  uint32_t *tdo_mask;
+  uint32_t *ret_mask;
   int has_tdo_data;
 };
 
-void SVFPlayer::bitdata_free(struct bitdata_s *bd, int offset)
+//Forgets the data of the last scan, the buffers stay in the arena
+void SVFPlayer::bitdata_free(struct bitdata_s *bd)
 {
-  h_realloc(bd->tdi_data, 0, (libxsvf_mem)(offset+0));
-  h_realloc(bd->tdi_mask, 0, (libxsvf_mem)(offset+1));
-  h_realloc(bd->tdo_data, 0, (libxsvf_mem)(offset+2));
-  h_realloc(bd->tdo_mask, 0, (libxsvf_mem)(offset+3));
-  h_realloc(bd->ret_mask, 0, (libxsvf_mem)(offset+4));
-
   bd->tdi_data = NULL;
   bd->tdi_mask = NULL;
   bd->tdo_data = NULL;
@@ -160,37 +150,95 @@ void SVFPlayer::bitdata_free(struct bitdata_s *bd, int offset)
   bd->ret_mask = NULL;
 }
 
-int hex(char ch)
+static inline int hex(char ch)
+{
+  unsigned char c = ch;
+  if ((unsigned char)(c - '0') < 10)
+    return c - '0';
+  c |= 0x20;
+  if ((unsigned char)(c - 'a') < 6)
+    return (c - 'a') + 10;
+  return -1;
+}
+
+//Decodes 8 hex digits (already checked) into a word, the first digit is the most significant.
+//All 8 digits are converted at once in a 64bit register: each byte becomes its nibble value,
+//then neighbouring lanes are merged 8->16->32 bits.
+static inline uint32_t hex_decode8(const char *p)
 {
-  if (ch >= 'A' && ch <= 'Z')
-    return (ch - 'A') + 10;
-  if (ch >= '0' && ch <= '9')
-    return ch - '0';
-  return 0;
+  uint64_t x;
+  memcpy(&x, p, 8);
+  //'0'-'9' keep their low nibble, 'A'-'F' and 'a'-'f' (bit 6 set) get +9
+  x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >> 6) & 0x0101010101010101ULL) * 9;
+  x = ((x & 0x000F000F000F000FULL) << 4) | ((x >> 8) & 0x000F000F000F000FULL);
+  x = ((x & 0x000000FF000000FFULL) << 8) | ((x >> 16) & 0x000000FF000000FFULL);
+  return (uint32_t) (((x & 0xFFFF) << 16) | ((x >> 32) & 0xFFFF));
 }
 
+//Decodes the hex string after a '(' straight into words, the last digit is bit 0.
+//Returns the text after the closing ')'.
+const char * SVFPlayer::hex_parse(const char *p, uint32_t *words, int nwords)
+{
+  //find the runs of digits, a long string may be split over several lines
+  hex_runs.clear();
+  while (1) {
+    p = skip_space(p);
+    if (*p == ')')
+      break;
+    const char *start = p;
+    while (hex(*p) >= 0)
+      p++;
+    if (p == start)
+      return NULL;
+    hex_run run = {start, (int) (p - start)};
+    hex_runs.push_back(run);
+  }
+
+  //every word is written once: whole words directly, the rest are cleared as they are started
+  int nibble = 0;
+  int max_nibbles = nwords * 8;
+  for (size_t iRun = hex_runs.size(); iRun > 0 && nibble < max_nibbles; iRun--) {
+    const char *start = hex_runs[iRun-1].start;
+    const char *end = start + hex_runs[iRun-1].len;
+    while (end > start && nibble < max_nibbles) {
+      if ((nibble & 0x7) == 0 && (end - start) >= 8) {
+	end -= 8;
+	words[nibble >> 3] = hex_decode8(end);
+	nibble += 8;
+      } else {
+	end--;
+	if ((nibble & 0x7) == 0)
+	  words[nibble >> 3] = 0;
+	words[nibble >> 3] |= ((uint32_t) hex(*end)) << ((nibble & 0x7) * 4);
+	nibble++;
+      }
+    }
+  }
+  //words past the last digit are zero
+  int written = (nibble + 7) >> 3;
+  if (written < nwords)
+    memset(&words[written], 0, (nwords - written) * sizeof(uint32_t));
+  return p + 1;
+}
 
 const char * SVFPlayer::bitdata_parse(const char *p, struct bitdata_s *bd, int offset)
 {
-  int i, j;
   bd->len = 0;
   bd->has_tdo_data = 0;
   while (*p >= '0' && *p <= '9') {
     bd->len = bd->len * 10 + (*p - '0');
     p++;
   }
-  while (*p == ' ') {
-    p++;
-  }
+  p = skip_space(p);
   if (bd->len != bd->alloced_len) {
-    bitdata_free(bd, offset);
+    bitdata_free(bd);
     bd->alloced_len = bd->len;
-    bd->alloced_bytes = (bd->len+7) / 8;
+    bd->alloced_words = (bd->len+31) / 32;
   }
-  while (*p)
+  while (*p && *p != ';')
     {
       int memnum = 0;
-      unsigned char **dp = NULL;
+      uint32_t **dp = NULL;
       if (!strtokencmp(p, "TDI")) {
 	p += strtokenskip(p);
 	dp = &bd->tdi_data;
@@ -220,114 +268,98 @@ const char * SVFPlayer::bitdata_parse(const char *p, struct bitdata_s *bd, int o
       if (!dp)
 	return NULL;
       if (*dp == NULL) {
-	*dp = (unsigned char *) h_realloc(*dp, bd->alloced_bytes, (libxsvf_mem)(offset+memnum));
+	*dp = bit_buffer((libxsvf_mem)(offset+memnum), bd->alloced_words);
       }
       if (*dp == NULL) {
 	fprintf(stderr, "Allocating memory failed.\n");
 	return NULL;
       }
 
-      unsigned char *d = *dp;
-      for (i=0; i<bd->alloced_bytes; i++)
-	d[i] = 0;
-
       if (*p != '(')
 	return NULL;
-      p++;
-
-      int hexdigits = 0;
-      for (i=0; (p[i] >= 'A' && p[i] <= 'F') || (p[i] >= '0' && p[i] <= '9'); i++)
-	hexdigits++;
-
-      i = bd->alloced_bytes*2 - hexdigits;
-      for (j=0; j<hexdigits; j++, i++, p++) {
-//	if (i%2 == 0) {
-//	  d[i/2] |= hex(*p) << 4;
-//	} else {
-//	  d[i/2] |= hex(*p);
-//	}
-	if ((i&0x1) == 0x0) {
-	  d[i>>1] |= hex(*p) << 4;
-	} else {
-	  d[i>>1] |= hex(*p);
-	}
-
-      }
-
-      if (*p != ')')
+      p = hex_parse(p + 1, *dp, bd->alloced_words);
+      if (!p)
 	return NULL;
-      p++;
-      while (*p == ' ') {
-	p++;
-      }
+      p = skip_space(p);
     }
 #if 0
   /* Debugging Output, needs <stdio.h> */
+  int i;
   printf("--- Parsed bitdata [%d] ---\n", bd->len);
   if (bd->tdi_data) {
     printf("TDI DATA:");
-    for (i=0; i<bd->alloced_bytes; i++)
-      printf(" %02x", bd->tdi_data[i]);
+    for (i=bd->alloced_words-1; i>=0; i--)
+      printf(" %08x", bd->tdi_data[i]);
     printf("\n");
   }
-  if (bd->tdo_data && has_tdo_data) {
+  if (bd->tdo_data && bd->has_tdo_data) {
     printf("TDO DATA:");
-    for (i=0; i<bd->alloced_bytes; i++)
-      printf(" %02x", bd->tdo_data[i]);
+    for (i=bd->alloced_words-1; i>=0; i--)
+      printf(" %08x", bd->tdo_data[i]);
     printf("\n");
   }
   if (bd->tdi_mask) {
     printf("TDI MASK:");
-    for (i=0; i<bd->alloced_bytes; i++)
-      printf(" %02x", bd->tdi_mask[i]);
+    for (i=bd->alloced_words-1; i>=0; i--)
+      printf(" %08x", bd->tdi_mask[i]);
     printf("\n");
   }
   if (bd->tdo_mask) {
     printf("TDO MASK:");
-    for (i=0; i<bd->alloced_bytes; i++)
-      printf(" %02x", bd->tdo_mask[i]);
+    for (i=bd->alloced_words-1; i>=0; i--)
+      printf(" %08x", bd->tdo_mask[i]);
     printf("\n");
   }
 #endif
   return p;
 }
 
-int SVFPlayer::getbit(unsigned char *data, int n)
-{
-  //  return (data[n/8] & (1 << (7 - n%8))) ? 1 : 0;
-  return (data[(n>>3)] & (1 << (7 - (n&0x7)))) ? 1 : 0;
-}
-
 int SVFPlayer::bitdata_play(struct bitdata_s *bd, enum libxsvf_tap_state estate)
 {
-  //  int left_padding = (8 - bd->len % 8) % 8;
-  int left_padding = (8 - (bd->len & 0x7)) & 0x7;
-  int tdo_error = 0;
-  int tms = 0;
-  int i;
+  if (bd->len <= 0)
+    return 0;
+
+  //the last bit of the scan moves SHIFT to EXIT1 if we aren't staying in SHIFT
+  int exit_shift = (tap_state != estate);
+  if (exit_shift)
+    tap_state = (libxsvf_tap_state)((int)tap_state + 1);
 
-  for (i=bd->len+left_padding-1; i >= left_padding; i--) {
-    if (i == left_padding && tap_state != estate) {
-      tap_state = (libxsvf_tap_state)((int)tap_state + 1);
-      tms = 1;
+  int verify = bd->tdo_data && bd->has_tdo_data;
+  if (verify) {
+    add_tdo_scan(shifted_tcks(), bd->len, command_count);
+  }
+
+  if (per_bit) {
+    //one pulse_tck() per TCK like before the word engine, for svfBench
+    for (int k = 0; k < bd->len; k++) {
+      int tdi = bd->tdi_data ? (bd->tdi_data[k >> 5] >> (k & 0x1F)) & 0x1 : -1;
+      int tdo = -1;
+      if (verify && (!bd->tdo_mask || ((bd->tdo_mask[k >> 5] >> (k & 0x1F)) & 0x1)))
+	tdo = (bd->tdo_data[k >> 5] >> (k & 0x1F)) & 0x1;
+      pulse_tck(exit_shift && (k + 1) == bd->len, tdi, tdo, 0, 0);
     }
-    int tdi = -1;
-    if (bd->tdi_data) {
-      if (!bd->tdi_mask || getbit(bd->tdi_mask, i))
-	tdi = getbit(bd->tdi_data, i);
+  } else {
+    for (int k = 0; k < bd->len; k += 32) {
+      int nbits = (bd->len - k) < 32 ? (bd->len - k) : 32;
+      //SMASK only marks don't-care bits, so the TDI data can be shifted as is
+      uint32_t tdi = bd->tdi_data ? bd->tdi_data[k >> 5] : 0;
+      uint32_t tdo = 0;
+      uint32_t tdo_mask = 0;
+      if (verify) {
+	tdo = bd->tdo_data[k >> 5];
+	tdo_mask = bd->tdo_mask ? bd->tdo_mask[k >> 5] : 0xFFFFFFFF;
+      }
+      uint32_t tms = 0;
+      if (exit_shift && (k + nbits) == bd->len)
+	tms = 1UL << (nbits - 1);
+      shift_word(tms, tdi, tdo, tdo_mask, nbits);
     }
-    int tdo = -1;
-    if (bd->tdo_data && bd->has_tdo_data && (!bd->tdo_mask || getbit(bd->tdo_mask, i)))
-      tdo = getbit(bd->tdo_data, i);
-    int rmask = bd->ret_mask && getbit(bd->ret_mask, i);
-    if(pulse_tck(tms, tdi, tdo, rmask, 0) < 0)
-      tdo_error = 1;
+    if (bd->tdi_data)
+      bitcount_tdi += bd->len;
   }
 
-  // if (tms)
-    //  report_tapstate();
-
-  if (!tdo_error)
+  //TDO is checked as each word is read back, so this reports mismatches found so far
+  if (!tdo_errors)
     return 0;
 
   fprintf(stderr, "TDO mismatch.\n");
@@ -336,8 +368,7 @@ int SVFPlayer::bitdata_play(struct bitdata_s *bd, enum libxsvf_tap_state estate)
 
 int SVFPlayer::svf_reader()
 { 
-  char *command_buffer = NULL;
-  int command_buffer_len = 0;
+  const char *command = NULL;
   int rc, i;
 
   struct bitdata_s bd_hdr = { 0, 0, 0, NULL, NULL, NULL, NULL, NULL, 0};
@@ -354,12 +385,13 @@ int SVFPlayer::svf_reader()
 
   while (1)
     {
-      rc = read_command(&command_buffer, &command_buffer_len);
+      rc = read_command(&command);
 
       if (rc <= 0)
 	break;
+      command_count++;
 
-      const char *p = command_buffer;
+      const char *p = command;
 
       if (!strtokencmp(p, "ENDIR")) {
 	p += strtokenskip(p);
@@ -411,9 +443,7 @@ int SVFPlayer::svf_reader()
 	  for(i=0; i<exp; i++)
 	    number *= 10;
 	}
-	while (*p == ' ') {
-	  p++;
-	}
+	p = skip_space(p);
 	p += strtokenskip(p);
 	if(set_frequency(number) < 0) {
 	  fprintf(stderr, "FREQUENCY command failed!\n");
@@ -448,7 +478,7 @@ int SVFPlayer::svf_reader()
 	int sck_count = -1;
 	int min_time = -1;
 	int max_time = -1;
-	while (*p) {
+	while (*p && *p != ';') {
 	  int got_maximum = 0;
 	  if (!strtokencmp(p, "MAXIMUM")) {
 	    p += strtokenskip(p);
@@ -520,9 +550,7 @@ int SVFPlayer::svf_reader()
 	  } else {
 	    number_e6 = number * 1000000;
 	  }
-	  while (*p == ' ') {
-	    p++;
-	  }
+	  p = skip_space(p);
 	  if (!strtokencmp(p, "SEC")) {
 	    p += strtokenskip(p);
 	    if (got_maximum)
@@ -554,7 +582,10 @@ int SVFPlayer::svf_reader()
 	  }
 	}
 	if (min_time >= 0 || tck_count >= 0) {
-	  //	  udelay(min_time >= 0 ? min_time : 0, 0, tck_count >= 0 ? tck_count : 0);
+	  //TMS stays high if the run state is RESET
+	  udelay(min_time >= 0 ? min_time : 0,
+		 tap_state == LIBXSVF_TAP_RESET,
+		 tck_count >= 0 ? tck_count : 0);
 	}
 	if(tap_walk((libxsvf_tap_state)state_endrun) < 0)
 	  goto error;
@@ -599,7 +630,7 @@ int SVFPlayer::svf_reader()
 
       if (!strtokencmp(p, "STATE")) {
 	p += strtokenskip(p);
-	while (*p) {
+	while (*p && *p != ';') {
 	  int st = token2tapstate(p);
 	  if (st < 0)
 	    goto syntax_error;
@@ -652,31 +683,40 @@ int SVFPlayer::svf_reader()
       }
 
     eol_check:
-      while (*p == ' ')
-	p++;
-      if (*p == 0)
+      p = skip_space(p);
+      if (*p == ';') {
+	svf_next = p + 1;
 	continue;
+      }
+      if (*p == 0) {
+	fprintf(stderr, "Unexpected EOF.\n");
+	goto error;
+      }
 
     syntax_error:
-      fprintf(stderr, "SVF Syntax Error:");
+      fprintf(stderr, "SVF Syntax Error in command %d:", command_count);
       if (0) {
       unsupported_error:
 	fprintf(stderr, "Error in SVF input: unsupported command:");
       }
+      {
+	int len = 0;
+	while (len < 64 && command[len] && command[len] != ';')
+	  len++;
+	fprintf(stderr, " %.*s\n", len, command);
+      }
     error:
       rc = -1;
       break;
     }
 
-  bitdata_free(&bd_hdr, LIBXSVF_MEM_SVF_HDR_TDI_DATA);
-  bitdata_free(&bd_hir, LIBXSVF_MEM_SVF_HIR_TDI_DATA);
-  bitdata_free(&bd_tdr, LIBXSVF_MEM_SVF_TDR_TDI_DATA);
-  bitdata_free(&bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
-  bitdata_free(&bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
-  bitdata_free(&bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
+  bitdata_free(&bd_hdr);
+  bitdata_free(&bd_hir);
+  bitdata_free(&bd_tdr);
+  bitdata_free(&bd_tir);
+  bitdata_free(&bd_sdr);
+  bitdata_free(&bd_sir);
 
-  h_realloc(command_buffer, 0, LIBXSVF_MEM_SVF_COMMANDBUF);
-  rc = 0;
   return rc;
 }
 
@@ -1,164 +1,117 @@
 #include "ApolloSM/svfplayer.hh"
-#include <sys/time.h>
-#include <unistd.h>
-#include <string>
-#include <stdlib.h>
 #include <stdio.h>
-#include <errno.h>
 #include <stdint.h>
-#include <sys/mman.h>
-#include <sys/types.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>  
 
+/*
+ * TAP state walks
+ *
+ * Every walk comes from a 17x17 table of the shortest TMS sequences between
+ * the states, built by the compiler.  A path never passes through RESET unless
+ * RESET is where it goes, so a walk can't reset the chain on the way.  INIT
+ * (state unknown) always clocks six TMS=1 to reach RESET first.
+ */
 
-void SVFPlayer::tap_transition(int v)
+struct tap_path {
+  uint16_t tms; //bit 0 is clocked first
+  uint8_t len;
+};
+
+static const uint8_t noPath = 0xFF;
+static const int searchDepth = 8;  //longer than any shortest path between two states
+
+//next state for TMS 0 and 1, INIT has no transitions of its own
+static constexpr uint8_t tapNext[17][2] = {
+  /* INIT      */ {LIBXSVF_TAP_INIT,      LIBXSVF_TAP_INIT},
+  /* RESET     */ {LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_RESET},
+  /* IDLE      */ {LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT},
+  /* DRSELECT  */ {LIBXSVF_TAP_DRCAPTURE, LIBXSVF_TAP_IRSELECT},
+  /* DRCAPTURE */ {LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1},
+  /* DRSHIFT   */ {LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1},
+  /* DREXIT1   */ {LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DRUPDATE},
+  /* DRPAUSE   */ {LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DREXIT2},
+  /* DREXIT2   */ {LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DRUPDATE},
+  /* DRUPDATE  */ {LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT},
+  /* IRSELECT  */ {LIBXSVF_TAP_IRCAPTURE, LIBXSVF_TAP_RESET},
+  /* IRCAPTURE */ {LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1},
+  /* IRSHIFT   */ {LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1},
+  /* IREXIT1   */ {LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IRUPDATE},
+  /* IRPAUSE   */ {LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IREXIT2},
+  /* IREXIT2   */ {LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IRUPDATE},
+  /* IRUPDATE  */ {LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT}
+};
+
+static constexpr tap_path tap_prepend(int tms, tap_path path)
 {
-  pulse_tck(v, -1, -1, 0, 0);
+  return (path.len == noPath) ? path : tap_path{(uint16_t) (tms | (path.tms << 1)), (uint8_t) (path.len + 1)};
 }
 
-int SVFPlayer::tap_walk(enum libxsvf_tap_state s)
+//the shorter path, the TMS=0 branch on a tie
+static constexpr tap_path tap_shorter(tap_path a, tap_path b)
+{
+  return (b.len < a.len) ? b : a;
+}
+
+//depth first search, C++11 constexpr functions are a single return statement
+static constexpr tap_path tap_search(int from, int to, int depth, bool first)
+{
+  return (from == to) ? tap_path{0, 0} :
+    (depth == 0 || (from == LIBXSVF_TAP_RESET && !first)) ? tap_path{0, noPath} :
+    tap_shorter(tap_prepend(0, tap_search(tapNext[from][0], to, depth - 1, false)),
+		tap_prepend(1, tap_search(tapNext[from][1], to, depth - 1, false)));
+}
+
+static constexpr tap_path tap_reset_path(int to)
+{
+  return (to == LIBXSVF_TAP_RESET) ? tap_path{0x3F, 6} :
+    tap_path{(uint16_t) (0x3F | (tap_search(LIBXSVF_TAP_RESET, to, searchDepth, true).tms << 6)),
+	     (uint8_t) (6 + tap_search(LIBXSVF_TAP_RESET, to, searchDepth, true).len)};
+}
+
+static constexpr tap_path tap_path_of(int from, int to)
 {
-  int i, j;
-  for (i=0; s != tap_state; i++)
-    {
-      switch (tap_state)
-	{
-	  /* Special States */
-	case LIBXSVF_TAP_INIT:
-	  for (j = 0; j < 6; j++)
-	    tap_transition(1);
-	  tap_state = LIBXSVF_TAP_RESET;
-	  break;
-	case LIBXSVF_TAP_RESET:
-	  tap_transition(0);
-	  tap_state = LIBXSVF_TAP_IDLE;
-	  break;
-	case LIBXSVF_TAP_IDLE:
-	  tap_transition(1);
-	  tap_state = LIBXSVF_TAP_DRSELECT;
-	  break;
+  return (to == LIBXSVF_TAP_INIT) ? tap_path{0, noPath} :
+    (from == LIBXSVF_TAP_INIT) ? tap_reset_path(to) :
+    tap_search(from, to, searchDepth, true);
+}
 
-	  /* DR States */
-	case LIBXSVF_TAP_DRSELECT:
-	  if (s >= LIBXSVF_TAP_IRSELECT || s == LIBXSVF_TAP_RESET) {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_IRSELECT;
-	  } else {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_DRCAPTURE;
-	  }
-	  break;
-	case LIBXSVF_TAP_DRCAPTURE:
-	  if (s == LIBXSVF_TAP_DRSHIFT) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_DRSHIFT;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_DREXIT1;
-	  }
-	  break;
-	case LIBXSVF_TAP_DRSHIFT:
-	  tap_transition(1);
-	  tap_state = LIBXSVF_TAP_DREXIT1;
-	  break;
-	case LIBXSVF_TAP_DREXIT1:
-	  if (s == LIBXSVF_TAP_DRPAUSE) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_DRPAUSE;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_DRUPDATE;
-	  }
-	  break;
-	case LIBXSVF_TAP_DRPAUSE:
-	  tap_transition(1);
-	  tap_state = LIBXSVF_TAP_DREXIT2;
-	  break;
-	case LIBXSVF_TAP_DREXIT2:
-	  if (s == LIBXSVF_TAP_DRSHIFT) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_DRSHIFT;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_DRUPDATE;
-	  }
-	  break;
-	case LIBXSVF_TAP_DRUPDATE:
-	  if (s == LIBXSVF_TAP_IDLE) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_IDLE;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_DRSELECT;
-	  }
-	  break;
+#define TAP_PATH_ROW(from) {						\
+    tap_path_of(from,  0), tap_path_of(from,  1), tap_path_of(from,  2), \
+    tap_path_of(from,  3), tap_path_of(from,  4), tap_path_of(from,  5), \
+    tap_path_of(from,  6), tap_path_of(from,  7), tap_path_of(from,  8), \
+    tap_path_of(from,  9), tap_path_of(from, 10), tap_path_of(from, 11), \
+    tap_path_of(from, 12), tap_path_of(from, 13), tap_path_of(from, 14), \
+    tap_path_of(from, 15), tap_path_of(from, 16)}
 
-	  /* IR States */
-	case LIBXSVF_TAP_IRSELECT:
-	  if (s == LIBXSVF_TAP_RESET) {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_RESET;
-	  } else {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_IRCAPTURE;
-	  }
-	  break;
-	case LIBXSVF_TAP_IRCAPTURE:
-	  if (s == LIBXSVF_TAP_IRSHIFT) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_IRSHIFT;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_IREXIT1;
-	  }
-	  break;
-	case LIBXSVF_TAP_IRSHIFT:
-	  tap_transition(1);
-	  tap_state = LIBXSVF_TAP_IREXIT1;
-	  break;
-	case LIBXSVF_TAP_IREXIT1:
-	  if (s == LIBXSVF_TAP_IRPAUSE) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_IRPAUSE;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_IRUPDATE;
-	  }
-	  break;
-	case LIBXSVF_TAP_IRPAUSE:
-	  tap_transition(1);
-	  tap_state = LIBXSVF_TAP_IREXIT2;
-	  break;
-	case LIBXSVF_TAP_IREXIT2:
-	  if (s == LIBXSVF_TAP_IRSHIFT) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_IRSHIFT;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_IRUPDATE;
-	  }
-	  break;
-	case LIBXSVF_TAP_IRUPDATE:
-	  if (s == LIBXSVF_TAP_IDLE) {
-	    tap_transition(0);
-	    tap_state = LIBXSVF_TAP_IDLE;
-	  } else {
-	    tap_transition(1);
-	    tap_state = LIBXSVF_TAP_DRSELECT;
-	  }
-	  break;
+static constexpr tap_path tapPaths[17][17] = {
+  TAP_PATH_ROW( 0), TAP_PATH_ROW( 1), TAP_PATH_ROW( 2), TAP_PATH_ROW( 3),
+  TAP_PATH_ROW( 4), TAP_PATH_ROW( 5), TAP_PATH_ROW( 6), TAP_PATH_ROW( 7),
+  TAP_PATH_ROW( 8), TAP_PATH_ROW( 9), TAP_PATH_ROW(10), TAP_PATH_ROW(11),
+  TAP_PATH_ROW(12), TAP_PATH_ROW(13), TAP_PATH_ROW(14), TAP_PATH_ROW(15),
+  TAP_PATH_ROW(16)
+};
+#undef TAP_PATH_ROW
 
-	default:
-	  fprintf(stderr, "Illegal tap state.\n");
-	  return -1;
-	}
-      if (i>10) {
-	fprintf(stderr, "Loop in tap walker.\n"); 
-	return -1;
-      }
-    }
+static_assert(tapPaths[LIBXSVF_TAP_IDLE][LIBXSVF_TAP_IRSHIFT].len == 4, "IDLE to IRSHIFT is 1100");
+static_assert(tapPaths[LIBXSVF_TAP_IRSELECT][LIBXSVF_TAP_DRSHIFT].len == 6, "paths must not pass through RESET");
+static_assert(tapPaths[LIBXSVF_TAP_INIT][LIBXSVF_TAP_IDLE].len == 7, "INIT goes through RESET");
 
+//Moves to state s, the TMS sequence goes into the shift buffer as one word
+int SVFPlayer::tap_walk(enum libxsvf_tap_state s)
+{
+  if ((unsigned) s > LIBXSVF_TAP_IRUPDATE || (unsigned) tap_state > LIBXSVF_TAP_IRUPDATE) {
+    fprintf(stderr, "Illegal tap state.\n");
+    return -1;
+  }
+  tap_path const & path = tapPaths[tap_state][s];
+  if (path.len == noPath) {
+    fprintf(stderr, "Loop in tap walker.\n");
+    return -1;
+  }
+  if (path.len > 0) {
+    //TDI holds its last value during the walk
+    shift_word(path.tms, tdival ? 0xFFFFFFFF : 0, 0, 0, path.len);
+    tmsval = (path.tms >> (path.len - 1)) & 0x1;
+  }
+  tap_state = s;
   return 0;
 }
@@ -0,0 +1,85 @@
+#include <ApolloSM/uioIRQ.hh>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+//how long a sleep lasts before busy() is checked again, covers lost interrupts
+static const int sleepTimeoutMs = 10;
+static const uint32_t defaultSpinUsecs = 50;
+
+UIOIRQ::UIOIRQ():fd(-1),spin_ns(defaultSpinUsecs*1000ULL),typical_ns(0),sleeps(0) {
+}
+
+UIOIRQ::~UIOIRQ() {
+  Close();
+}
+
+int UIOIRQ::Open(std::string const & device) {
+  Close();
+  fd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", device.c_str(), strerror(errno));
+    return -1;
+  }
+  //UIO drivers without interrupt support refuse the unmask write
+  if (arm() < 0) {
+    fprintf(stderr, "%s has no usable interrupt\n", device.c_str());
+    Close();
+    return -1;
+  }
+  return 0;
+}
+
+void UIOIRQ::Close() {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void UIOIRQ::SetSpin(uint32_t usecs) {
+  spin_ns = usecs * 1000ULL;
+}
+
+//Spin about twice as long as a wait usually takes, waits longer than the
+//ceiling are sleeps anyway so only spin a little before them
+uint64_t UIOIRQ::spin_limit() const {
+  if (typical_ns > spin_ns) {
+    return spin_ns / 8;
+  }
+  uint64_t limit = 2 * typical_ns;
+  return (limit > spin_ns || limit == 0) ? spin_ns : limit;
+}
+
+void UIOIRQ::record(uint64_t waitNs) {
+  typical_ns = (typical_ns == 0) ? waitNs : (7 * typical_ns + waitNs) / 8;
+}
+
+//Unmasks the interrupt, a UIO device takes a 32bit 1
+int UIOIRQ::arm() {
+  if (fd < 0) {
+    return -1;
+  }
+  uint32_t unmask = 1;
+  if (write(fd, &unmask, sizeof(unmask)) != sizeof(unmask)) {
+    return -1;
+  }
+  return 0;
+}
+
+void UIOIRQ::sleep() {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, sleepTimeoutMs) > 0 && (pfd.revents & POLLIN)) {
+    //the interrupt count
+    uint32_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,265 @@
+#include <ApolloSM/uioLabelFinder.hh>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <boost/filesystem.hpp>
+
+using namespace boost::filesystem;
+
+static std::string const uiopath = "/sys/class/uio/";
+static std::string const dvtpath = "/proc/device-tree/amba_pl/";
+static char const cacheMagic[] = "uioindex1";
+
+//First line of a file, up to the NUL or newline
+static bool read_line(std::string const & fileName, std::string & line) {
+  FILE * inFile = fopen(fileName.c_str(), "r");
+  if (NULL == inFile) {
+    return false;
+  }
+  char buffer[1024];
+  bool ok = (fgets(buffer, sizeof(buffer), inFile) != NULL);
+  fclose(inFile);
+  if (ok) {
+    line.assign(buffer, strcspn(buffer, "\n"));
+  }
+  return ok;
+}
+
+static uint64_t hash_string(uint64_t hash, std::string const & str) {
+  for (size_t i = 0; i < str.size(); i++) {
+    hash = (hash ^ (unsigned char) str[i]) * 0x100000001b3ULL;
+  }
+  return (hash ^ 0xFF) * 0x100000001b3ULL;
+}
+
+UIOIndex::UIOIndex() : loaded_signature(0) {
+}
+
+//Hash of the boot, of the entry names in both directories and of the map0
+//address of every UIO device.  An overlay adds or removes nodes and UIO
+//devices, so the listings change with it; the addresses catch a uioN that
+//was renumbered onto another device between two loads.
+uint64_t UIOIndex::signature() {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  std::string bootID;
+  read_line("/proc/sys/kernel/random/boot_id", bootID);
+  hash = hash_string(hash, bootID);
+  std::string const paths[2] = {dvtpath, uiopath};
+  for (int iPath = 0; iPath < 2; iPath++) {
+    boost::system::error_code ec;
+    for (directory_iterator itDir(paths[iPath], ec); !ec && itDir != directory_iterator(); itDir.increment(ec)) {
+      std::string name = itDir->path().filename().native();
+      hash = hash_string(hash, name);
+      std::string addr;
+      if (paths[iPath] == uiopath && name.compare(0, 3, "uio") == 0 &&
+	  read_line(itDir->path().native() + "/maps/map0/addr", addr)) {
+	hash = hash_string(hash, addr);
+      }
+    }
+    hash = hash_string(hash, "/");
+  }
+  return hash;
+}
+
+//Walks the device tree once for the labels and /sys/class/uio once for the maps
+int UIOIndex::scan() {
+  devices.clear();
+  std::multimap<uint64_t, std::string> labelsByAddr;
+  boost::system::error_code ec;
+  for (directory_iterator itDir(dvtpath, ec); !ec && itDir != directory_iterator(); itDir.increment(ec)) {
+    std::string label;
+    if (!is_directory(itDir->path()) || !read_line(itDir->path().native() + "/label", label)) {
+      continue;
+    }
+    //expect the name to be in x@xxxxxxxx format for example myReg@41200000
+    std::string name = itDir->path().filename().native();
+    size_t at = name.rfind('@');
+    if (at == std::string::npos || at + 1 == name.size()) {
+      std::cout << "directory name " << name << " has incorrect format." << std::endl;
+      continue;
+    }
+    labelsByAddr.insert(std::make_pair(strtoull(name.c_str() + at + 1, NULL, 16), label));
+  }
+
+  for (directory_iterator itDir(uiopath, ec); !ec && itDir != directory_iterator(); itDir.increment(ec)) {
+    std::string name = itDir->path().filename().native();
+    std::string addr, size;
+    if (name.compare(0, 3, "uio") != 0 ||
+	!read_line(itDir->path().native() + "/maps/map0/addr", addr) ||
+	!read_line(itDir->path().native() + "/maps/map0/size", size)) {
+      continue;
+    }
+    uio_device device;
+    device.uio = strtol(name.c_str() + 3, NULL, 10);
+    device.addr = strtoull(addr.c_str(), NULL, 16);
+    device.size = strtoull(size.c_str(), NULL, 16);
+    auto range = labelsByAddr.equal_range(device.addr);
+    for (auto itLabel = range.first; itLabel != range.second; ++itLabel) {
+      device.label = itLabel->second;
+      devices.push_back(device);
+    }
+  }
+  build_map();
+  return devices.size();
+}
+
+void UIOIndex::build_map() {
+  by_label.clear();
+  for (size_t iDev = 0; iDev < devices.size(); iDev++) {
+    //the first device with a label wins, as it did for the directory walk
+    by_label.insert(std::make_pair(devices[iDev].label, iDev));
+  }
+}
+
+//Only trusts a cache that nobody else could have written
+bool UIOIndex::read_cache(std::string const & cacheFile, uint64_t sig) {
+  //checked on the open file, not a symlink or a file swapped in after the check
+  int fd = open(cacheFile.c_str(), O_RDONLY | O_NOFOLLOW);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+      (st.st_uid != geteuid() && st.st_uid != 0) ||
+      (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    close(fd);
+    return false;
+  }
+  FILE * in = fdopen(fd, "r");
+  if (in == NULL) {
+    close(fd);
+    return false;
+  }
+  char magic[16];
+  unsigned long long fileSig;
+  bool ok = (fscanf(in, "%15s %llx\n", magic, &fileSig) == 2 &&
+	     strcmp(magic, cacheMagic) == 0 && fileSig == sig);
+  devices.clear();
+  char line[1200];
+  while (ok && fgets(line, sizeof(line), in) != NULL) {
+    uio_device device;
+    unsigned long long addr, size;
+    int labelStart = 0;
+    if (sscanf(line, "%d %llx %llx %n", &device.uio, &addr, &size, &labelStart) < 3 || labelStart == 0) {
+      ok = false;
+      break;
+    }
+    device.addr = addr;
+    device.size = size;
+    device.label.assign(line + labelStart, strcspn(line + labelStart, "\n"));
+    devices.push_back(device);
+  }
+  fclose(in);
+  if (!ok) {
+    devices.clear();
+  }
+  build_map();
+  return ok;
+}
+
+//Written to a new temporary file next to it and renamed, so readers never see
+//half of it.  mkstemp() never follows or reuses a file someone else put there
+void UIOIndex::write_cache(std::string const & cacheFile, uint64_t sig) const {
+  std::vector<char> tmpFile(cacheFile.begin(), cacheFile.end());
+  static char const suffix[] = ".XXXXXX";
+  tmpFile.insert(tmpFile.end(), suffix, suffix + sizeof(suffix));
+  int fd = mkstemp(&tmpFile[0]);
+  if (fd < 0) {
+    return;
+  }
+  fchmod(fd, 0644);
+  FILE * out = fdopen(fd, "w");
+  if (out == NULL) {
+    close(fd);
+    unlink(&tmpFile[0]);
+    return;
+  }
+  bool ok = fprintf(out, "%s %llx\n", cacheMagic, (unsigned long long) sig) > 0;
+  for (size_t iDev = 0; ok && iDev < devices.size(); iDev++) {
+    ok = fprintf(out, "%d %llx %llx %s\n", devices[iDev].uio,
+		 (unsigned long long) devices[iDev].addr,
+		 (unsigned long long) devices[iDev].size,
+		 devices[iDev].label.c_str()) > 0;
+  }
+  ok = (fclose(out) == 0) && ok;
+  if (!ok || rename(&tmpFile[0], cacheFile.c_str()) != 0) {
+    unlink(&tmpFile[0]);
+  }
+}
+
+int UIOIndex::Load(std::string const & cacheFile) {
+  uint64_t sig = signature();
+  loaded_signature = sig;
+  if (cacheFile.empty()) {
+    return scan();
+  }
+  if (read_cache(cacheFile, sig)) {
+    return devices.size();
+  }
+  scan();
+  write_cache(cacheFile, sig);
+  return devices.size();
+}
+
+uio_device const * UIOIndex::Find(std::string const & label) const {
+  std::map<std::string, size_t>::const_iterator it = by_label.find(label);
+  return (it == by_label.end()) ? NULL : &devices[it->second];
+}
+
+std::vector<int> UIOIndex::Find(std::vector<std::string> const & labels) const {
+  std::vector<int> uios(labels.size(), -1);
+  for (size_t iLabel = 0; iLabel < labels.size(); iLabel++) {
+    uio_device const * device = Find(labels[iLabel]);
+    if (device != NULL) {
+      uios[iLabel] = device->uio;
+    }
+  }
+  return uios;
+}
+
+//Loaded on first use, later hits don't touch the file system.  After a miss
+//the caller asks again with missed set, which reloads the index if the
+//system changed since.  A replaced index is never freed, the entries
+//label2device() handed out point into it.
+static UIOIndex const * process_index(bool missed = false) {
+  static std::mutex indexMutex;
+  static UIOIndex * index = NULL;
+  std::lock_guard<std::mutex> lock(indexMutex);
+  if (index == NULL || (missed && index->Changed())) {
+    UIOIndex * newIndex = new UIOIndex;
+    newIndex->Load();
+    index = newIndex;
+  }
+  return index;
+}
+
+int label2uio(std::string const & label) {
+  uio_device const * device = label2device(label);
+  if (device == NULL) {
+    std::cout << "Cannot find a device that matches label " << label << " device not opened!" << std::endl;
+    return -1;
+  }
+  return device->uio;
+}
+
+std::vector<int> label2uio(std::vector<std::string> const & labels) {
+  std::vector<int> uios = process_index()->Find(labels);
+  if (std::find(uios.begin(), uios.end(), -1) != uios.end()) {
+    uios = process_index(true)->Find(labels);
+  }
+  return uios;
+}
+
+uio_device const * label2device(std::string const & label) {
+  uio_device const * device = process_index()->Find(label);
+  if (device == NULL) {
+    device = process_index(true)->Find(label);
+  }
+  return device;
+}
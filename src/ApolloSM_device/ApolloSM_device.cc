@@ -111,7 +111,51 @@ void ApolloSMDevice::LoadCommandList(){
     AddCommand("svfplayer",&ApolloSMDevice::svfplayer,
 	       "Converts an SVF file to jtag commands in AXI format\n" \
 	       "Usage: \n" \
-	       "  svfplayer svf-file XVC-device\n");
+	       "  svfplayer svf-file XVC-device <batch-words> <GO-poll-reads>\n" \
+	       "  batch-words > 1 sends each JTAG word and its GO-poll-reads (default 1) in one dispatch\n" \
+	       "  GO-poll-reads 0 is for a core that buffers words, batch-words words share a dispatch\n" \
+	       "  svf-file may also be a program written by svfcompile\n");
+
+    AddCommand("svfmulti",&ApolloSMDevice::svfmulti,
+	       "Plays SVF files on several JTAG chains at once, one thread per chain\n" \
+	       "Usage: \n" \
+	       "  svfmulti batch-words GO-poll-reads svf-file XVC-device [svf-file XVC-device ...]\n");
+
+    AddCommand("svfcompile",&ApolloSMDevice::svfcompile,
+	       "Converts an SVF file to a compiled JTAG program for svfplayer\n" \
+	       "Usage: \n" \
+	       "  svfcompile svf-file program-file\n");
+
+    AddCommand("svfcache",&ApolloSMDevice::svfcache,
+	       "Keeps compiled programs of played SVF files in a directory\n" \
+	       "Usage: \n" \
+	       "  svfcache cache-dir\n" \
+	       "  svfcache           disables the cache\n");
+
+    AddCommand("svfpipeline",&ApolloSMDevice::svfpipeline,
+	       "Parses SVF files on one thread and does the JTAG bus I/O on another\n" \
+	       "Usage: \n" \
+	       "  svfpipeline ring-words\n" \
+	       "  svfpipeline 0      plays on one thread\n");
+
+    AddCommand("svfirq",&ApolloSMDevice::svfirq,
+	       "Waits for the JTAG core on its UIO interrupt instead of spinning on GO\n" \
+	       "Usage: \n" \
+	       "  svfirq uio-device <spin-usecs>\n" \
+	       "  svfirq             spins on GO\n");
+
+    AddCommand("svfmock",&ApolloSMDevice::svfmock,
+	       "Plays SVF files into a core simulated by jtagSim instead of the bus\n" \
+	       "Usage: \n" \
+	       "  svfmock register-file\n" \
+	       "  svfmock            plays on the bus\n");
+
+    AddCommand("directio",&ApolloSMDevice::directio,
+	       "Reads and writes single ApolloSM registers (e.g. CM power) with loads and stores\n" \
+	       "on the UIO maps instead of uHAL, local connections only.\n" \
+	       "dump_debug keeps reading through uHAL, a block read per address run\n" \
+	       "Usage: \n" \
+	       "  directio <on|off>\n");
 
     AddCommand("GenerateHTMLStatus",&ApolloSMDevice::GenerateHTMLStatus,
 	       "Creates a status table as an html file\n" \
@@ -129,10 +173,11 @@ void ApolloSMDevice::LoadCommandList(){
 	       "  uart_cmd CMD_STRING\n");
 
     AddCommand("dump_debug",&ApolloSMDevice::DumpDebug,
-	       "Dumps all registers to a file for debugging\n"\
+	       "Dumps all registers to a text file and a binary snapshot file for debugging\n"\
 	       "Send to D. Gastler\n"\
 	       "Usage: \n"\
-	       "  dump_debug\n");
+	       "  dump_debug                           two full snapshots\n"\
+	       "  dump_debug snapshots <interval-ms>   only the registers that change\n");
 
 }
 
@@ -290,17 +335,139 @@ CommandReturn::status ApolloSMDevice::UART_CMD(std::vector<std::string> strArg,s
   return CommandReturn::OK;
 } 
 
-CommandReturn::status ApolloSMDevice::svfplayer(std::vector<std::string> strArg, std::vector<uint64_t>) {
+static void svfplayer_progress(SVFStats const & stats, void * /*data*/) {
+  printf("%5.1f%% %llu TCKs, %.3f MHz, bus %.1fs, parsing %.1fs\n",
+	 100.0*stats.progress, (unsigned long long) stats.tcks,
+	 1E-6*stats.TCKRate(), stats.bus_seconds, stats.parse_seconds);
+  fflush(stdout);
+}
+
+CommandReturn::status ApolloSMDevice::svfplayer(std::vector<std::string> strArg, std::vector<uint64_t> intArg) {
 
-  if(2 != strArg.size()) {
+  size_t batchWords = 1;
+  size_t pollReads = 1;
+  switch (strArg.size()) {
+  case 4:
+    pollReads = intArg[3];
+    //fallthrough
+  case 3:
+    batchWords = intArg[2];
+    //fallthrough
+  case 2:
+    break;
+  default:
     return CommandReturn::BAD_ARGS;
   }
 
-  SM->svfplayer(strArg[0],strArg[1]);
+  SM->svfplayer(strArg[0],strArg[1],batchWords,pollReads,NULL,svfplayer_progress);
   
   return CommandReturn::OK;
 }
 
+CommandReturn::status ApolloSMDevice::svfmulti(std::vector<std::string> strArg, std::vector<uint64_t> intArg) {
+  if (strArg.size() < 4 || (strArg.size() % 2) != 0) {
+    return CommandReturn::BAD_ARGS;
+  }
+  std::vector<std::pair<std::string,std::string> > chains;
+  for (size_t iArg = 2; iArg < strArg.size(); iArg += 2) {
+    chains.push_back(std::make_pair(strArg[iArg],strArg[iArg+1]));
+  }
+  SM->svfplayer(chains,intArg[0],intArg[1]);
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::svfcompile(std::vector<std::string> strArg, std::vector<uint64_t> /*intArg*/) {
+  if (strArg.size() != 2) {
+    return CommandReturn::BAD_ARGS;
+  }
+  SM->svfcompile(strArg[0],strArg[1]);
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::svfcache(std::vector<std::string> strArg, std::vector<uint64_t> /*intArg*/) {
+  switch (strArg.size()) {
+  case 0:
+    SM->SetSVFCache("");
+    printf("SVF program cache disabled\n");
+    break;
+  case 1:
+    SM->SetSVFCache(strArg[0]);
+    printf("SVF program cache in %s\n", strArg[0].c_str());
+    break;
+  default:
+    return CommandReturn::BAD_ARGS;
+  }
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::svfpipeline(std::vector<std::string> strArg, std::vector<uint64_t> intArg) {
+  if (strArg.size() != 1) {
+    return CommandReturn::BAD_ARGS;
+  }
+  SM->SetSVFPipeline(intArg[0]);
+  if (intArg[0] > 0) {
+    printf("SVF parsing and bus I/O pipelined over %llu words\n", (unsigned long long) intArg[0]);
+  } else {
+    printf("SVF pipeline disabled\n");
+  }
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::svfirq(std::vector<std::string> strArg, std::vector<uint64_t> intArg) {
+  uint32_t spinUsecs = 50;
+  switch (strArg.size()) {
+  case 0:
+    SM->SetSVFIRQ("",0);
+    printf("SVF player spins on GO\n");
+    return CommandReturn::OK;
+  case 2:
+    spinUsecs = intArg[1];
+    //fallthrough
+  case 1:
+    break;
+  default:
+    return CommandReturn::BAD_ARGS;
+  }
+  SM->SetSVFIRQ(strArg[0],spinUsecs);
+  printf("SVF player sleeps on the %s interrupt after %u us\n", strArg[0].c_str(), spinUsecs);
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::svfmock(std::vector<std::string> strArg, std::vector<uint64_t>) {
+  switch (strArg.size()) {
+  case 0:
+    SM->SetSVFMock("");
+    printf("SVF player plays on the bus\n");
+    return CommandReturn::OK;
+  case 1:
+    break;
+  default:
+    return CommandReturn::BAD_ARGS;
+  }
+  SM->SetSVFMock(strArg[0]);
+  printf("SVF player plays into the simulated core at %s\n", strArg[0].c_str());
+  return CommandReturn::OK;
+}
+
+CommandReturn::status ApolloSMDevice::directio(std::vector<std::string> strArg, std::vector<uint64_t>) {
+  bool enable = true;
+  if (strArg.size() > 1) {
+    return CommandReturn::BAD_ARGS;
+  } else if (strArg.size() == 1) {
+    if (boost::algorithm::iequals(strArg[0],"off")) {
+      enable = false;
+    } else if (!boost::algorithm::iequals(strArg[0],"on")) {
+      return CommandReturn::BAD_ARGS;
+    }
+  }
+  if (SM->EnableDirectIO(enable)) {
+    printf("Direct UIO register access %s\n", enable ? "on" : "off");
+  } else {
+    printf("Not a local connection, registers stay on uHAL\n");
+  }
+  return CommandReturn::OK;
+}
+
 CommandReturn::status ApolloSMDevice::GenerateHTMLStatus(std::vector<std::string> strArg, std::vector<uint64_t> level) {
   if (strArg.size() < 1) {
     return CommandReturn::BAD_ARGS;
@@ -329,17 +496,37 @@ CommandReturn::status ApolloSMDevice::GenerateHTMLStatus(std::vector<std::string
   return CommandReturn::OK;
 }
 
-CommandReturn::status ApolloSMDevice::DumpDebug(std::vector<std::string> /*strArg*/,
-						std::vector<uint64_t> /*intArg*/){
+CommandReturn::status ApolloSMDevice::DumpDebug(std::vector<std::string> strArg,
+						std::vector<uint64_t> intArg){
+  size_t snapshots = 0;
+  double interval = 1;
+  switch (strArg.size()) {
+  case 2:
+    interval = intArg[1]/1000.0;
+    //fallthrough
+  case 1:
+    snapshots = intArg[0];
+    break;
+  case 0:
+    break;
+  default:
+    return CommandReturn::BAD_ARGS;
+  }
+
   std::stringstream outfileName;
-  outfileName << "Apollo_debug_dump_";  
+  outfileName << (snapshots ? "Apollo_debug_delta_" : "Apollo_debug_dump_");  
   std::time_t time = std::time(NULL);
   outfileName << std::put_time(std::gmtime(&time),"%F-%T-%Z");
+  std::string binaryFileName = outfileName.str() + ".bin";
   outfileName << ".dat";
   
   std::ofstream outfile(outfileName.str().c_str(),std::ofstream::out);
   outfile << outfileName.str() << std::endl;
-  SM->DebugDump(outfile);
+  if (snapshots) {
+    SM->DebugDumpDelta(outfile,snapshots,interval,binaryFileName);
+  } else {
+    SM->DebugDump(outfile,binaryFileName);
+  }
   outfile.close();  
   return CommandReturn::OK;
 }
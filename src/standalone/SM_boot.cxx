@@ -30,6 +30,14 @@ struct temperatures {
   uint8_t REGTemp;
 };
 
+//Where the temperatures go for the IPMC
+struct temperatureRegisters {
+  ApolloSM::RegisterHandle MCUTemp;
+  ApolloSM::RegisterHandle FIREFLYTemp;
+  ApolloSM::RegisterHandle FPGATemp;
+  ApolloSM::RegisterHandle REGTemp;
+};
+
 // ====================================================================================================
 // Kill program if it is in background
 bool static volatile loop;
@@ -113,11 +121,20 @@ temperatures sendAndParse(ApolloSM* SM) {
 
 // ====================================================================================================
 
-void sendTemps(ApolloSM* SM, temperatures temps) {
-  SM->RegWriteRegister("SLAVE_I2C.S2.0", temps.MCUTemp);
-  SM->RegWriteRegister("SLAVE_I2C.S3.0", temps.FIREFLYTemp);
-  SM->RegWriteRegister("SLAVE_I2C.S4.0", temps.FPGATemp);
-  SM->RegWriteRegister("SLAVE_I2C.S5.0", temps.REGTemp);
+temperatureRegisters getTempRegisters(ApolloSM* SM) {
+  temperatureRegisters regs;
+  regs.MCUTemp     = SM->GetRegisterHandle("SLAVE_I2C.S2.0");
+  regs.FIREFLYTemp = SM->GetRegisterHandle("SLAVE_I2C.S3.0");
+  regs.FPGATemp    = SM->GetRegisterHandle("SLAVE_I2C.S4.0");
+  regs.REGTemp     = SM->GetRegisterHandle("SLAVE_I2C.S5.0");
+  return regs;
+}
+
+void sendTemps(temperatureRegisters const & regs, temperatures temps) {
+  regs.MCUTemp.Write(temps.MCUTemp);
+  regs.FIREFLYTemp.Write(temps.FIREFLYTemp);
+  regs.FPGATemp.Write(temps.FPGATemp);
+  regs.REGTemp.Write(temps.REGTemp);
 }
 
 // ====================================================================================================
@@ -223,6 +240,8 @@ int main(int, char**) {
 
   bool inShutdown = false;
   ApolloSM * SM = NULL;
+  ApolloSM::RegisterHandle hbSet1, hbSet2, statusDone, enableUC, shutdownReq;
+  temperatureRegisters tempRegs;
   try{
     // ==================================
     // Initialize ApolloSM
@@ -237,15 +256,27 @@ int main(int, char**) {
     std::vector<std::string> arg;
     arg.push_back("connections.xml");
     SM->Connect(arg);
+    if(SM->EnableDirectIO()){
+      fprintf(logFile,"Using direct UIO register access\n");
+      fflush(logFile);
+    }
+    //registers of the monitoring loop
+    hbSet1      = SM->GetRegisterHandle("SLAVE_I2C.HB_SET1");
+    hbSet2      = SM->GetRegisterHandle("SLAVE_I2C.HB_SET2");
+    statusDone  = SM->GetRegisterHandle("SLAVE_I2C.S1.SM.STATUS.DONE");
+    enableUC    = SM->GetRegisterHandle("CM.CM1.CTRL.ENABLE_UC");
+    shutdownReq = SM->GetRegisterHandle("SLAVE_I2C.S1.SM.STATUS.SHUTDOWN_REQ");
+    tempRegs    = getTempRegisters(SM);
+
     //Set the power-up done bit to 1 for the IPMC to read
-    SM->RegWriteRegister("SLAVE_I2C.S1.SM.STATUS.DONE",1);    
+    statusDone.Write(1);    
     fprintf(logFile,"Set STATUS.DONE to 1\n");
     fflush(logFile);
   
 
     // ====================================
     // Turn on CM uC      
-    SM->RegWriteRegister("CM.CM1.CTRL.ENABLE_UC",1);
+    enableUC.Write(1);
     fprintf(logFile,"Powering up CM uC\n");
     sleep(1);
   
@@ -263,22 +294,22 @@ int main(int, char**) {
       //=================================
 
       //PS heartbeat
-      SM->RegReadRegister("SLAVE_I2C.HB_SET1");
-      SM->RegReadRegister("SLAVE_I2C.HB_SET2");
+      hbSet1.Read();
+      hbSet2.Read();
 
       //Process CM temps
       temperatures temps;  
       //if(SM->RegReadRegister("CM.CM1.CTRL.IOS_ENABLED")){
-      if(SM->RegReadRegister("CM.CM1.CTRL.ENABLE_UC")){
+      if(enableUC.Read()){
 	temps = sendAndParse(SM);
-	sendTemps(SM, temps);
+	sendTemps(tempRegs, temps);
       }else{
 	temps = {0,0,0,0};
-	sendTemps(SM, temps);
+	sendTemps(tempRegs, temps);
       }
 
       //Check if we are shutting down
-      if((!inShutdown) && SM->RegReadRegister("SLAVE_I2C.S1.SM.STATUS.SHUTDOWN_REQ")){
+      if((!inShutdown) && shutdownReq.Read()){
 	fprintf(logFile,"Shutdown requested\n");
 	inShutdown = true;
 	//the IPMC requested a re-boot.
@@ -318,21 +349,29 @@ int main(int, char**) {
 
   //make sure the CM is off
   //Shutdown the command module (if up)
-  SM->PowerDownCM(1,5);
-  SM->RegWriteRegister("CM.CM1.CTRL.ENABLE_UC",0);
+  if(NULL != SM) {
+    SM->PowerDownCM(1,5);
+  }
+  if(enableUC.IsValid()){
+    enableUC.Write(0);
+  }
 
   
   //If we are shutting down, do the handshanking.
   if(inShutdown){
     fprintf(logFile,"Tell IPMC we have shut-down\n");
     //We are no longer booted
-    SM->RegWriteRegister("SLAVE_I2C.S1.SM.STATUS.DONE",0);
+    if(statusDone.IsValid()){
+      statusDone.Write(0);
+    }
     //we are shut down
     //    SM->RegWriteRegister("SLAVE_I2C.S1.SM.STATUS.SHUTDOWN",1);
     // one last HB
     //PS heartbeat
-    SM->RegReadRegister("SLAVE_I2C.HB_SET1");
-    SM->RegReadRegister("SLAVE_I2C.HB_SET2");
+    if(hbSet1.IsValid()){
+      hbSet1.Read();
+      hbSet2.Read();
+    }
 
   }
   
@@ -1,17 +1,31 @@
 #include <standalone/uioLabelFinder.hh>
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <iostream>
 
 int main(int argc, char ** argv){
   if(argc < 2){
-    printf("Usage: %s uio_label\n",argv[0]);
+    printf("Usage: %s uio_label [uio_label ...]\n",argv[0]);
+    printf("       %s --rescan   rebuilds the index in %s\n",argv[0],UIO_INDEX_CACHE_FILE);
     return 1;
   }
-  int uio = label2uio(argv[1]);
-  if(uio >= 0){
-    printf("%s is at /dev/uio%d\n",argv[1],uio);
-  }else{
-    printf("%s not found\n",argv[1]);
+  UIOIndex index;
+  if(!strcmp(argv[1],"--rescan")){
+    unlink(UIO_INDEX_CACHE_FILE);
+    printf("%d UIO devices\n",index.Load());
+    return 0;
+  }
+  index.Load();
+  for(int iArg = 1; iArg < argc; iArg++){
+    uio_device const * device = index.Find(argv[iArg]);
+    if(device != NULL){
+      printf("%s is at /dev/uio%d (0x%llx, 0x%llx bytes)\n",argv[iArg],device->uio,
+	     (unsigned long long) device->addr,(unsigned long long) device->size);
+    }else{
+      printf("%s not found\n",argv[iArg]);
+    }
   }
   return 0;
 }
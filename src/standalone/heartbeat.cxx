@@ -128,6 +128,7 @@ int main(int, char**) {
 
 
   ApolloSM * SM = NULL;
+  ApolloSM::RegisterHandle hbSet1, hbSet2;
   try{
     // ==================================
     // Initialize ApolloSM
@@ -142,6 +143,12 @@ int main(int, char**) {
     std::vector<std::string> arg;
     arg.push_back("connections.xml");
     SM->Connect(arg);
+    if(SM->EnableDirectIO()){
+      fprintf(logFile,"Using direct UIO register access\n");
+      fflush(logFile);
+    }
+    hbSet1 = SM->GetRegisterHandle("SLAVE_I2C.HB_SET1");
+    hbSet2 = SM->GetRegisterHandle("SLAVE_I2C.HB_SET2");
 
     // ==================================
     // Main DAEMON loop
@@ -156,8 +163,8 @@ int main(int, char**) {
       //=================================
 
       //PS heartbeat
-      SM->RegReadRegister("SLAVE_I2C.HB_SET1");
-      SM->RegReadRegister("SLAVE_I2C.HB_SET2");
+      hbSet1.Read();
+      hbSet2.Read();
 
       //=================================
 
@@ -178,8 +185,10 @@ int main(int, char**) {
   }
   
   //PS heartbeat
-  SM->RegReadRegister("SLAVE_I2C.HB_SET1");
-  SM->RegReadRegister("SLAVE_I2C.HB_SET2");
+  if(hbSet1.IsValid()){
+    hbSet1.Read();
+    hbSet2.Read();
+  }
   
   //Clean up
   if(NULL != SM) {
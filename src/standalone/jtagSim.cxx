@@ -0,0 +1,335 @@
+/*
+ * jtagSim: software model of the AXI JTAG core for running svfplayer and
+ * xvcServer without hardware.
+ *
+ * The register block (length, tms, tdi, tdo, ctrl) lives in a shared memory
+ * file that the tools map instead of the UIO device or the uHAL nodes
+ * (xvcServer --mock, BUTool svfmock).  Writing 1 to ctrl shifts length bits
+ * through a simulated TAP controller and a chain of devices, each with an
+ * instruction register and IDCODE/BYPASS data registers, and clears ctrl when
+ * done.  With a TCK rate the simulator holds ctrl set for as long as the real
+ * core would, so throughput measurements against it are reproducible.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <vector>
+#include <string>
+
+//TCLAP parser
+#include <tclap/CmdLine.h>
+
+#include <ApolloSM/axiJTAG.hh>
+
+enum tap_state {
+  TAP_RESET, TAP_IDLE,
+  TAP_DRSELECT, TAP_DRCAPTURE, TAP_DRSHIFT, TAP_DREXIT1, TAP_DRPAUSE, TAP_DREXIT2, TAP_DRUPDATE,
+  TAP_IRSELECT, TAP_IRCAPTURE, TAP_IRSHIFT, TAP_IREXIT1, TAP_IRPAUSE, TAP_IREXIT2, TAP_IRUPDATE
+};
+
+//next state for TMS 0 and 1
+static const uint8_t tapNext[16][2] = {
+  /* RESET     */ {TAP_IDLE,      TAP_RESET},
+  /* IDLE      */ {TAP_IDLE,      TAP_DRSELECT},
+  /* DRSELECT  */ {TAP_DRCAPTURE, TAP_IRSELECT},
+  /* DRCAPTURE */ {TAP_DRSHIFT,   TAP_DREXIT1},
+  /* DRSHIFT   */ {TAP_DRSHIFT,   TAP_DREXIT1},
+  /* DREXIT1   */ {TAP_DRPAUSE,   TAP_DRUPDATE},
+  /* DRPAUSE   */ {TAP_DRPAUSE,   TAP_DREXIT2},
+  /* DREXIT2   */ {TAP_DRSHIFT,   TAP_DRUPDATE},
+  /* DRUPDATE  */ {TAP_IDLE,      TAP_DRSELECT},
+  /* IRSELECT  */ {TAP_IRCAPTURE, TAP_RESET},
+  /* IRCAPTURE */ {TAP_IRSHIFT,   TAP_IREXIT1},
+  /* IRSHIFT   */ {TAP_IRSHIFT,   TAP_IREXIT1},
+  /* IREXIT1   */ {TAP_IRPAUSE,   TAP_IRUPDATE},
+  /* IRPAUSE   */ {TAP_IRPAUSE,   TAP_IREXIT2},
+  /* IREXIT2   */ {TAP_IRSHIFT,   TAP_IRUPDATE},
+  /* IRUPDATE  */ {TAP_IDLE,      TAP_DRSELECT}
+};
+
+//Xilinx 6 bit IDCODE instruction, all ones is BYPASS
+#define DEFAULT_IR_LENGTH 6
+#define IDCODE_INSTRUCTION 0x09
+
+struct sim_device {
+  uint32_t idcode;
+  int ir_length;
+  uint64_t ir;        //current instruction
+  uint64_t ir_shift;  //instruction shift register
+  uint32_t dr_shift;  //IDCODE or BYPASS shift register
+  int dr_length;      //32 for IDCODE, 1 for everything else
+};
+
+struct sim_chain {
+  std::vector<sim_device> devices; //devices[0] is next to TDI
+  int state;
+  uint64_t tcks;
+  uint64_t words;
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int) {
+  running = 0;
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void chain_reset(sim_chain & chain) {
+  for (size_t iDev = 0; iDev < chain.devices.size(); iDev++) {
+    chain.devices[iDev].ir = IDCODE_INSTRUCTION;
+  }
+}
+
+//One TCK: TDO comes from the last device before the chain shifts
+static int chain_tck(sim_chain & chain, int tms, int tdi) {
+  int tdo = 0;
+  switch (chain.state) {
+  case TAP_DRCAPTURE:
+    for (size_t iDev = 0; iDev < chain.devices.size(); iDev++) {
+      sim_device & dev = chain.devices[iDev];
+      if (dev.ir == IDCODE_INSTRUCTION) {
+	dev.dr_shift = dev.idcode;
+	dev.dr_length = 32;
+      } else {
+	dev.dr_shift = 0;
+	dev.dr_length = 1;
+      }
+    }
+    break;
+  case TAP_IRCAPTURE:
+    for (size_t iDev = 0; iDev < chain.devices.size(); iDev++) {
+      chain.devices[iDev].ir_shift = 0x1;
+    }
+    break;
+  case TAP_DRSHIFT:
+    {
+      int bit = tdi;
+      for (size_t iDev = 0; iDev < chain.devices.size(); iDev++) {
+	sim_device & dev = chain.devices[iDev];
+	int out = dev.dr_shift & 0x1;
+	dev.dr_shift = (dev.dr_shift >> 1) | ((uint32_t) bit << (dev.dr_length - 1));
+	bit = out;
+      }
+      tdo = bit;
+    }
+    break;
+  case TAP_IRSHIFT:
+    {
+      int bit = tdi;
+      for (size_t iDev = 0; iDev < chain.devices.size(); iDev++) {
+	sim_device & dev = chain.devices[iDev];
+	int out = dev.ir_shift & 0x1;
+	dev.ir_shift = (dev.ir_shift >> 1) | ((uint64_t) bit << (dev.ir_length - 1));
+	bit = out;
+      }
+      tdo = bit;
+    }
+    break;
+  case TAP_IRUPDATE:
+    for (size_t iDev = 0; iDev < chain.devices.size(); iDev++) {
+      chain.devices[iDev].ir = chain.devices[iDev].ir_shift;
+    }
+    break;
+  case TAP_RESET:
+    chain_reset(chain);
+    break;
+  default:
+    break;
+  }
+  chain.state = tapNext[chain.state][tms & 0x1];
+  chain.tcks++;
+  return tdo;
+}
+
+//Shifts one word of the register block, LSB first
+static uint32_t chain_shift(sim_chain & chain, int length, uint32_t tms, uint32_t tdi) {
+  uint32_t tdo = 0;
+  for (int iBit = 0; iBit < length; iBit++) {
+    tdo |= (uint32_t) chain_tck(chain, (tms >> iBit) & 0x1, (tdi >> iBit) & 0x1) << iBit;
+  }
+  chain.words++;
+  return tdo;
+}
+
+int main(int argc, char ** argv) {
+  std::string regFile;
+  int nDevices = 1;
+  int irLength = DEFAULT_IR_LENGTH;
+  uint32_t idcode = 0;
+  double tckMHz = 0;
+  uint32_t wordNs = 0;
+  bool quiet = false;
+
+  try {
+    TCLAP::CmdLine cmd("Simulated AXI JTAG core.",
+		       ' ',
+		       "jtagSim");
+
+    TCLAP::ValueArg<std::string> simFile("f",              //one char flag
+					 "file",      // full flag name
+					 "register file shared with svfmock or xvcServer --mock",//description
+					 false,            //required
+					 std::string("/dev/shm/jtagsim"),  //Default
+					 "path",         // type
+					 cmd);
+    TCLAP::ValueArg<int> simDevices("d",              //one char flag
+				    "devices",      // full flag name
+				    "devices in the chain",//description
+				    false,            //required
+				    1,  //Default
+				    "count",         // type
+				    cmd);
+    TCLAP::ValueArg<int> simIRLength("i",              //one char flag
+				     "ir-length",      // full flag name
+				     "instruction register bits of each device",//description
+				     false,            //required
+				     DEFAULT_IR_LENGTH,  //Default
+				     "bits",         // type
+				     cmd);
+    TCLAP::ValueArg<uint32_t> simIDCode("",              //one char flag
+					"idcode",      // full flag name
+					"IDCODE of the first device, the others count up from it",//description
+					false,            //required
+					0x04A56093,  //Default
+					"idcode",         // type
+					cmd);
+    TCLAP::ValueArg<double> simRate("r",              //one char flag
+				    "rate",      // full flag name
+				    "simulated TCK rate in MHz, 0 finishes every shift at once",//description
+				    false,            //required
+				    0,  //Default
+				    "MHz",         // type
+				    cmd);
+    TCLAP::ValueArg<uint32_t> simWordNs("l",              //one char flag
+					"latency",      // full flag name
+					"ns added to every shift, the bus round trip of the real core",//description
+					false,            //required
+					0,  //Default
+					"ns",         // type
+					cmd);
+    TCLAP::SwitchArg simQuiet("q",              //one char flag
+			      "quiet",      // full flag name
+			      "don't print the shift rate every second",//description
+			      cmd,
+			      false);
+
+    //Parse the command line arguments
+    cmd.parse(argc,argv);
+    regFile = simFile.getValue();
+    nDevices = simDevices.getValue();
+    irLength = simIRLength.getValue();
+    idcode = simIDCode.getValue();
+    tckMHz = simRate.getValue();
+    wordNs = simWordNs.getValue();
+    quiet = simQuiet.getValue();
+  }catch (TCLAP::ArgException &e) {
+    fprintf(stderr, "Error %s for arg %s\n",
+	    e.error().c_str(), e.argId().c_str());
+    return 1;
+  }
+  if (nDevices < 1 || irLength < 2 || irLength > 64) {
+    fprintf(stderr, "Need at least one device and an IR of 2 to 64 bits.\n");
+    return 1;
+  }
+
+  //the register file
+  int fd = open(regFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0 || ftruncate(fd, AXI_JTAG_MAP_SIZE) < 0) {
+    fprintf(stderr, "Failed to create %s: %s\n", regFile.c_str(), strerror(errno));
+    return 1;
+  }
+  close(fd);
+  axi_jtag_regs volatile * regs = axi_jtag_map_file(regFile);
+  if (regs == NULL) {
+    unlink(regFile.c_str());
+    return 1;
+  }
+
+  sim_chain chain;
+  chain.devices.resize(nDevices);
+  for (int iDev = 0; iDev < nDevices; iDev++) {
+    memset(&chain.devices[iDev], 0, sizeof(sim_device));
+    chain.devices[iDev].idcode = idcode + iDev;
+    chain.devices[iDev].ir_length = irLength;
+    chain.devices[iDev].dr_length = 1;
+  }
+  chain_reset(chain);
+  chain.state = TAP_RESET;
+  chain.tcks = 0;
+  chain.words = 0;
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  fprintf(stderr, "Simulating %d device(s) at %s", nDevices, regFile.c_str());
+  if (tckMHz > 0) {
+    fprintf(stderr, ", TCK %.3f MHz", tckMHz);
+  }
+  fprintf(stderr, "\n");
+
+  double nsPerTCK = (tckMHz > 0) ? 1E3/tckMHz : 0;
+  uint64_t reportNs = now_ns() + 1000000000ULL;
+  uint64_t reportTCKs = 0;
+  uint64_t reportWords = 0;
+  unsigned idle = 0;
+  while (running) {
+    if (regs->ctrl == 0) {
+      //spin while the tools are busy, give the CPU away when they are not
+      if (++idle >= 1024) {
+	idle = 0;
+	sched_yield();
+	uint64_t now = now_ns();
+	if (!quiet && now >= reportNs && chain.words != reportWords) {
+	  double seconds = 1E-9*(now - reportNs + 1000000000ULL);
+	  fprintf(stderr, "%llu words, %.3f MTCK/s\n",
+		  (unsigned long long) (chain.words - reportWords),
+		  1E-6*(chain.tcks - reportTCKs)/seconds);
+	  reportTCKs = chain.tcks;
+	  reportWords = chain.words;
+	  reportNs = now + 1000000000ULL;
+	} else if (now >= reportNs) {
+	  reportNs = now + 1000000000ULL;
+	}
+      }
+      continue;
+    }
+    idle = 0;
+    uint64_t start = (nsPerTCK > 0 || wordNs > 0) ? now_ns() : 0;
+    //the tools publish the vectors before they set ctrl
+    __sync_synchronize();
+    int length = regs->length;
+    if (length < 1 || length > 32) {
+      fprintf(stderr, "Bad shift length %d, shifting 32 bits\n", length);
+      length = 32;
+    }
+    regs->tdo = chain_shift(chain, length, regs->tms, regs->tdi);
+    if (start) {
+      //hold ctrl as long as the real core would
+      uint64_t done = start + wordNs + (uint64_t) (nsPerTCK * length);
+      while (now_ns() < done) {}
+    }
+    __sync_synchronize();
+    regs->ctrl = 0;
+  }
+
+  fprintf(stderr, "%llu TCKs in %llu words\n",
+	  (unsigned long long) chain.tcks, (unsigned long long) chain.words);
+  axi_jtag_unmap_file(regs);
+  unlink(regFile.c_str());
+  return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * svfBench: plays a synthetic SVF file of a few megabits through SVFPlayer
+ * twice, once shifting one TCK at a time through pulse_tck() as the player did
+ * before scans were packed into words and once with the word engine, and
+ * prints the playback statistics of both.
+ *
+ * The player runs against a register file instead of the bus (SVFPlayer::
+ * SetMock).  By default the bench serves that file itself with a core that
+ * finishes every shift at once and loops TDI back to TDO, so the generated TDO
+ * checks pass and the times are the player's own.  With -f it plays into a
+ * running jtagSim instead, without TDO checks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <thread>
+#include <string>
+
+//TCLAP parser
+#include <tclap/CmdLine.h>
+
+#include <ApolloSM/svfplayer.hh>
+#include <ApolloSM/axiJTAG.hh>
+#include <BUException/ExceptionBase.hh>
+
+//The per-bit shift path is private to SVFPlayer, this is its only user
+class SVFPlayerBench {
+public:
+  static void SetPerBitShift(SVFPlayer & player, bool perBit) {player.per_bit = perBit;}
+};
+
+static uint64_t xorshift64(uint64_t & state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+//Random hex digits of an nbits scan, the unused high bits of the first digit are 0
+static void write_hex(FILE * out, int nbits, uint64_t & state, std::string & line) {
+  static const char digits[] = "0123456789ABCDEF";
+  int nDigits = (nbits + 3) / 4;
+  line.resize(nDigits);
+  uint64_t random = 0;
+  for (int iDigit = 0; iDigit < nDigits; iDigit++) {
+    if ((iDigit & 0xF) == 0) {
+      random = xorshift64(state);
+    }
+    line[iDigit] = digits[random & 0xF];
+    random >>= 4;
+  }
+  if (nbits & 0x3) {
+    line[0] = digits[(line[0] <= '9' ? line[0] - '0' : line[0] - 'A' + 10) & ((1 << (nbits & 0x3)) - 1)];
+  }
+  fwrite(line.data(), 1, line.size(), out);
+}
+
+//SDR scans of scanBits until megabits are written, with a TDO check on every
+//tdoEvery'th scan that expects TDI looped back to TDO
+static int generate_svf(std::string const & svfFile, double megabits, int scanBits, int tdoEvery) {
+  FILE * out = fopen(svfFile.c_str(), "w");
+  if (out == NULL) {
+    fprintf(stderr, "Failed to create %s: %s\n", svfFile.c_str(), strerror(errno));
+    return -1;
+  }
+  fprintf(out,
+	  "// svfBench, %.1f Mbit in %d bit scans\n"
+	  "TRST OFF;\nENDIR IDLE;\nENDDR IDLE;\nSTATE RESET;\nSTATE IDLE;\n"
+	  "FREQUENCY 1E7 HZ;\nHIR 0;\nTIR 0;\nHDR 0;\nTDR 0;\n"
+	  "SIR 6 TDI (02);\n",
+	  megabits, scanBits);
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  std::string line;
+  uint64_t totalBits = megabits * 1E6;
+  uint64_t bits = 0;
+  for (int iScan = 0; bits < totalBits; iScan++) {
+    int nbits = scanBits;
+    if (totalBits - bits < (uint64_t) nbits) {
+      nbits = totalBits - bits;
+    }
+    fprintf(out, "SDR %d TDI (", nbits);
+    uint64_t tdiState = state;
+    write_hex(out, nbits, state, line);
+    fprintf(out, ")");
+    if (tdoEvery > 0 && (iScan % tdoEvery) == 0) {
+      //the same digits again
+      fprintf(out, " TDO (");
+      write_hex(out, nbits, tdiState, line);
+      fprintf(out, ")");
+    }
+    fprintf(out, ";\n");
+    if ((iScan & 0x7) == 0x7) {
+      fprintf(out, "RUNTEST 100 TCK;\n");
+    }
+    bits += nbits;
+  }
+  fprintf(out, "STATE RESET;\n");
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Failed to write %s\n", svfFile.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+//A core that finishes each shift as soon as it sees it, TDO is TDI
+static void loopback_core(axi_jtag_regs volatile * regs, std::atomic<bool> * running) {
+  unsigned idle = 0;
+  while (running->load(std::memory_order_relaxed)) {
+    if (regs->ctrl == 0) {
+      if (++idle >= 256) {
+	idle = 0;
+	//the player may share our CPU
+	sched_yield();
+      }
+      continue;
+    }
+    idle = 0;
+    __sync_synchronize();
+    uint32_t length = regs->length;
+    uint32_t mask = (length >= 32) ? 0xFFFFFFFF : ((1UL << length) - 1);
+    regs->tdo = regs->tdi & mask;
+    __sync_synchronize();
+    regs->ctrl = 0;
+  }
+}
+
+static int play(std::string const & svfFile, std::string const & regFile,
+		size_t pipelineWords, bool perBit, SVFStats & stats) {
+  uhal::HwInterface * hw = NULL;
+  SVFPlayer player(&hw);
+  if (player.SetMock(regFile) < 0) {
+    return -1;
+  }
+  player.SetPipeline(pipelineWords);
+  SVFPlayerBench::SetPerBitShift(player, perBit);
+  int rc;
+  try {
+    rc = player.play(svfFile, "BENCH");
+  } catch (BUException::exBase const & e) {
+    fprintf(stderr, "Caught BUException: %s\n   Info: %s\n", e.what(), e.Description());
+    rc = -1;
+  } catch (std::exception const & e) {
+    fprintf(stderr, "Caught std::exception: %s\n", e.what());
+    rc = -1;
+  }
+  stats = player.Stats();
+  return rc;
+}
+
+static void print_stats(char const * name, SVFStats const & stats) {
+  printf("%-8s %12llu %10llu %9.3f %9.3f %9.3f %9.3f %9.2f\n", name,
+	 (unsigned long long) stats.tcks, (unsigned long long) stats.words,
+	 stats.total_seconds, stats.parse_seconds, stats.bus_seconds, stats.delay_seconds,
+	 1E-6*stats.TCKRate());
+}
+
+int main(int argc, char ** argv) {
+  double megabits;
+  int scanBits;
+  int tdoEvery;
+  std::string svfFile;
+  bool keep;
+  std::string simFile;
+  size_t pipelineWords;
+  try {
+    TCLAP::CmdLine cmd("SVFPlayer benchmark, per-bit against word shifting.",
+		       ' ',
+		       "svfBench");
+    TCLAP::ValueArg<double> benchMegabits("m",              //one char flag
+					  "megabits",      // full flag name
+					  "scan data in the generated SVF file",//description
+					  false,            //required
+					  16,  //Default
+					  "Mbit",         // type
+					  cmd);
+    TCLAP::ValueArg<int> benchScanBits("s",              //one char flag
+				       "scan-bits",      // full flag name
+				       "bits of each SDR scan",//description
+				       false,            //required
+				       100000,  //Default
+				       "bits",         // type
+				       cmd);
+    TCLAP::ValueArg<int> benchTDOEvery("t",              //one char flag
+				       "tdo-every",      // full flag name
+				       "check TDO on every n'th scan, 0 for none (built-in core only)",//description
+				       false,            //required
+				       4,  //Default
+				       "n",         // type
+				       cmd);
+    TCLAP::ValueArg<std::string> benchSVFFile("o",              //one char flag
+					      "svf",      // full flag name
+					      "generated SVF file",//description
+					      false,            //required
+					      std::string("/tmp/svfBench.svf"),  //Default
+					      "path",         // type
+					      cmd);
+    TCLAP::SwitchArg benchKeep("k",              //one char flag
+			       "keep",      // full flag name
+			       "keep the generated SVF file",//description
+			       cmd,
+			       false);
+    TCLAP::ValueArg<std::string> benchSimFile("f",              //one char flag
+					      "file",      // full flag name
+					      "register file of a running jtagSim instead of the built-in core",//description
+					      false,            //required
+					      std::string(""),  //Default
+					      "path",         // type
+					      cmd);
+    TCLAP::ValueArg<size_t> benchPipeline("p",              //one char flag
+					  "pipeline",      // full flag name
+					  "ring words between parsing and bus I/O, 0 for one thread",//description
+					  false,            //required
+					  0,  //Default
+					  "words",         // type
+					  cmd);
+
+    //Parse the command line arguments
+    cmd.parse(argc,argv);
+    megabits = benchMegabits.getValue();
+    scanBits = benchScanBits.getValue();
+    tdoEvery = benchTDOEvery.getValue();
+    svfFile = benchSVFFile.getValue();
+    keep = benchKeep.getValue();
+    simFile = benchSimFile.getValue();
+    pipelineWords = benchPipeline.getValue();
+  }catch (TCLAP::ArgException &e) {
+    fprintf(stderr, "Error %s for arg %s\n",
+	    e.error().c_str(), e.argId().c_str());
+    return 1;
+  }
+  if (megabits <= 0 || scanBits < 1) {
+    fprintf(stderr, "Need some scan data.\n");
+    return 1;
+  }
+  if (!simFile.empty()) {
+    //jtagSim runs a real TAP, looped back TDO wouldn't match
+    tdoEvery = 0;
+  }
+
+  if (generate_svf(svfFile, megabits, scanBits, tdoEvery) < 0) {
+    return 1;
+  }
+
+  //the built-in core's register file
+  std::string regFile = simFile;
+  axi_jtag_regs volatile * regs = NULL;
+  std::atomic<bool> running(true);
+  std::thread core;
+  if (regFile.empty()) {
+    char name[64];
+    snprintf(name, sizeof(name), "/tmp/svfBench.regs.%d", getpid());
+    regFile = name;
+    int fd = open(regFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, AXI_JTAG_MAP_SIZE) < 0) {
+      fprintf(stderr, "Failed to create %s: %s\n", regFile.c_str(), strerror(errno));
+      return 1;
+    }
+    close(fd);
+    regs = axi_jtag_map_file(regFile);
+    if (regs == NULL) {
+      unlink(regFile.c_str());
+      return 1;
+    }
+    core = std::thread(loopback_core, regs, &running);
+  }
+
+  SVFStats perBit, word;
+  int rcPerBit = play(svfFile, regFile, pipelineWords, true, perBit);
+  int rcWord = play(svfFile, regFile, pipelineWords, false, word);
+
+  if (regs != NULL) {
+    running = false;
+    core.join();
+    axi_jtag_unmap_file(regs);
+    unlink(regFile.c_str());
+  }
+  if (!keep) {
+    unlink(svfFile.c_str());
+  }
+
+  printf("\n%-8s %12s %10s %9s %9s %9s %9s %9s\n",
+	 "shift", "TCKs", "words", "total(s)", "parse(s)", "bus(s)", "wait(s)", "MTCK/s");
+  print_stats("per-bit", perBit);
+  print_stats("word", word);
+  if (word.total_seconds > 0) {
+    printf("word shifting is %.2fx the per-bit rate", perBit.total_seconds / word.total_seconds);
+    if (word.parse_seconds > 0) {
+      printf(", parsing %.2fx", perBit.parse_seconds / word.parse_seconds);
+    }
+    printf("\n");
+  }
+
+  if (rcPerBit != 0 || rcWord != 0) {
+    fprintf(stderr, "Playback failed.\n");
+    return 1;
+  }
+  if (perBit.tcks != word.tcks || perBit.tdi_bits != word.tdi_bits || perBit.tdo_bits != word.tdo_bits) {
+    fprintf(stderr, "The two shift paths disagree.\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,721 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <ApolloSM/ApolloSM.hh>
+#include <ApolloSM/registerSnapshot.hh>
+#include <ApolloSM/spscRing.hh>
+#include <BUException/ExceptionBase.hh>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <set>
+
+//TCLAP parser
+#include <tclap/CmdLine.h>
+
+/*
+ * High rate register telemetry
+ *
+ * A sampling thread reads the registers with RegisterSnapshot (one batched
+ * dispatch per sample) on a fixed period and puts the samples into a single
+ * producer single consumer ring (spsc_ring).  The main thread sleeps until
+ * there are samples, takes them off the ring, delta encodes them and appends
+ * them to a memory mapped file.  A full ring drops the sample rather than
+ * delaying the sampler.
+ *
+ * File: telemetry_header, the NUL terminated register names, the addresses
+ * and masks (uint32_t each), then data_size bytes of records:
+ *   type       'K' key record or 'D' delta record
+ *   varint     ns since the previous record, since start_ns for 'K'
+ *   varint     number of registers that changed
+ *   per register that changed:
+ *     varint   (index - previous index - 1) << 1 | status changed
+ *     byte     new status, only if it changed
+ *     varint   zigzag(value - previous value), the value of a bad read is 0
+ * A 'K' record is encoded against all zero values and good status, so decoding
+ * can start from any of them.  data_size and samples are updated after every
+ * record, a recording cut short by a crash is readable up to its last record.
+ */
+
+static const char telemetryMagic[8] = {'A','P','O','L','L','O','T','S'};
+#define TELEMETRY_VERSION 1
+
+struct telemetry_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t registers;
+  uint64_t names_size;  //bytes of NUL terminated names after the header
+  uint64_t start_ns;    //CLOCK_REALTIME of the first sample
+  uint64_t period_ns;
+  uint64_t key_interval;
+  uint64_t samples;
+  uint64_t data_size;   //bytes of records after the masks
+};
+
+// ====================================================================================================
+bool static volatile loop;
+
+void static signal_handler(int const signum) {
+  if(SIGINT == signum || SIGTERM == signum) {
+    loop = false;
+  }
+}
+
+static uint64_t realtime_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint8_t * put_varint(uint8_t * out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *out++ = value;
+  return out;
+}
+
+//Returns NULL if the varint runs past end
+static uint8_t const * get_varint(uint8_t const * in, uint8_t const * end, uint64_t & value) {
+  value = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t byte = *in++;
+    value |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return in;
+    }
+  }
+  return NULL;
+}
+
+static uint32_t zigzag(uint32_t delta) {
+  return (delta << 1) ^ (uint32_t) (((int32_t) delta) >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value) {
+  return (value >> 1) ^ (0 - (value & 0x1));
+}
+
+// ====================================================================================================
+// Sample ring, the sampler produces and the writer consumes
+struct sample_ring {
+  size_t slots;      //power of two
+  size_t registers;
+  std::vector<uint32_t> values;
+  std::vector<uint8_t> status;
+  std::vector<uint64_t> times;  //CLOCK_MONOTONIC
+  spsc_ring index;
+  std::atomic<bool> done;
+  //sampler statistics
+  uint64_t dropped;
+  uint64_t late;
+  uint64_t sampleNs;
+};
+
+static void sampler(RegisterSnapshot * snapshot, sample_ring * ring, uint64_t periodNs, uint64_t samples) {
+  size_t mask = ring->slots - 1;
+  size_t head = ring->index.head.load(std::memory_order_relaxed);
+  size_t tailCache = 0;
+  std::vector<uint32_t> scratchValues(ring->registers);
+  std::vector<uint8_t> scratchStatus(ring->registers);
+  uint64_t next = monotonic_ns();
+  try {
+    for (uint64_t iSample = 0; loop && (samples == 0 || iSample < samples); iSample++) {
+      struct timespec deadline = {time_t(next / 1000000000ULL), long(next % 1000000000ULL)};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && loop) {
+      }
+
+      bool full = (head - tailCache >= ring->slots);
+      if (full) {
+	tailCache = ring->index.tail.load(std::memory_order_acquire);
+	full = (head - tailCache >= ring->slots);
+      }
+      uint64_t now = monotonic_ns();
+      size_t slot = head & mask;
+      //a dropped sample is still read so the bus sees the same load
+      uint32_t * values = full ? &scratchValues[0] : &ring->values[slot * ring->registers];
+      uint8_t * status  = full ? &scratchStatus[0] : &ring->status[slot * ring->registers];
+      snapshot->Take(values, status);
+      uint64_t end = monotonic_ns();
+      ring->sampleNs += end - now;
+      if (full) {
+	ring->dropped++;
+      } else {
+	ring->times[slot] = now;
+	head++;
+	ring->index.head.store(head, std::memory_order_release);
+	ring->index.WakeConsumer();
+      }
+
+      next += periodNs;
+      if (end > next) {
+	//missed the next deadline, start again from now instead of catching up
+	ring->late++;
+	next = end;
+      }
+    }
+  } catch (BUException::exBase const & e) {
+    fprintf(stderr, "Sampling stopped: %s\n", e.what());
+  } catch (std::exception const & e) {
+    fprintf(stderr, "Sampling stopped: %s\n", e.what());
+  }
+  ring->done.store(true, std::memory_order_release);
+  ring->index.WakeConsumer();
+}
+
+// ====================================================================================================
+// Memory mapped output file, grown in chunks as records are appended
+class TelemetryFile {
+public:
+  TelemetryFile() : fd(-1), map(NULL), map_size(0), data_offset(0), max_size(0) {}
+  ~TelemetryFile() {Close();}
+  int Open(std::string const & fileName, RegisterSnapshot const & snapshot,
+	   uint64_t periodNs, uint64_t keyInterval, uint64_t maxSize);
+  //Space for a record of up to size bytes, NULL if the file is at its maximum
+  uint8_t * Reserve(size_t size);
+  void Commit(uint8_t * end);
+  uint64_t Size() const {return data_offset + (header() ? header()->data_size : 0);}
+  void SetStart(uint64_t startNs) {header()->start_ns = startNs;}
+  void Close();
+private:
+  telemetry_header * header() const {return (telemetry_header *) map;}
+  int grow(size_t size);
+  int fd;
+  uint8_t * map;
+  size_t map_size;
+  size_t data_offset;
+  size_t max_size;
+};
+
+static const size_t fileChunk = 16 << 20;
+
+int TelemetryFile::grow(size_t size) {
+  size = ((size + fileChunk - 1) / fileChunk) * fileChunk;
+  if (max_size && size > max_size) {
+    size = max_size;
+  }
+  if (size <= map_size) {
+    return -1;
+  }
+  if (ftruncate(fd, size) != 0) {
+    fprintf(stderr, "Failed to grow telemetry file: %s\n", strerror(errno));
+    return -1;
+  }
+  void * newMap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == newMap) {
+    fprintf(stderr, "Failed to map telemetry file: %s\n", strerror(errno));
+    return -1;
+  }
+  if (map) {
+    munmap(map, map_size);
+  }
+  map = (uint8_t *) newMap;
+  map_size = size;
+  return 0;
+}
+
+int TelemetryFile::Open(std::string const & fileName, RegisterSnapshot const & snapshot,
+			uint64_t periodNs, uint64_t keyInterval, uint64_t maxSize) {
+  std::vector<std::string> const & names = snapshot.Names();
+  size_t namesSize = 0;
+  for (size_t iReg = 0; iReg < names.size(); iReg++) {
+    namesSize += names[iReg].size() + 1;
+  }
+  data_offset = sizeof(telemetry_header) + namesSize + 2 * names.size() * sizeof(uint32_t);
+  max_size = maxSize;
+  if (max_size && max_size < data_offset + fileChunk) {
+    max_size = data_offset + fileChunk;
+  }
+
+  fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create %s: %s\n", fileName.c_str(), strerror(errno));
+    return -1;
+  }
+  if (grow(data_offset + fileChunk) < 0) {
+    Close();
+    return -1;
+  }
+
+  telemetry_header * h = header();
+  memcpy(h->magic, telemetryMagic, sizeof(telemetryMagic));
+  h->version = TELEMETRY_VERSION;
+  h->header_size = sizeof(telemetry_header);
+  h->registers = names.size();
+  h->names_size = namesSize;
+  h->start_ns = 0;
+  h->period_ns = periodNs;
+  h->key_interval = keyInterval;
+  h->samples = 0;
+  h->data_size = 0;
+  uint8_t * out = map + sizeof(telemetry_header);
+  for (size_t iReg = 0; iReg < names.size(); iReg++) {
+    memcpy(out, names[iReg].c_str(), names[iReg].size() + 1);
+    out += names[iReg].size() + 1;
+  }
+  for (size_t iReg = 0; iReg < names.size(); iReg++, out += sizeof(uint32_t)) {
+    uint32_t addr = snapshot.Address(iReg);
+    memcpy(out, &addr, sizeof(addr));
+  }
+  for (size_t iReg = 0; iReg < names.size(); iReg++, out += sizeof(uint32_t)) {
+    uint32_t mask = snapshot.Mask(iReg);
+    memcpy(out, &mask, sizeof(mask));
+  }
+  return 0;
+}
+
+uint8_t * TelemetryFile::Reserve(size_t size) {
+  size_t used = data_offset + header()->data_size;
+  if (used + size > map_size && (grow(used + size) < 0 || used + size > map_size)) {
+    return NULL;
+  }
+  return map + used;
+}
+
+void TelemetryFile::Commit(uint8_t * end) {
+  header()->data_size = (end - map) - data_offset;
+  header()->samples++;
+}
+
+//Cuts the file back to what was written
+void TelemetryFile::Close() {
+  if (map) {
+    size_t used = Size();
+    msync(map, used, MS_SYNC);
+    munmap(map, map_size);
+    map = NULL;
+    if (ftruncate(fd, used) != 0) {
+      fprintf(stderr, "Failed to truncate telemetry file: %s\n", strerror(errno));
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+// ====================================================================================================
+// Encoding, prevValues/prevStatus hold the last record's registers
+static uint8_t * encode_sample(uint8_t * out, bool key, uint64_t deltaNs, size_t nRegs,
+			       uint32_t const * values, uint8_t const * status,
+			       uint32_t * prevValues, uint8_t * prevStatus) {
+  if (key) {
+    memset(prevValues, 0, nRegs * sizeof(uint32_t));
+    memset(prevStatus, RegisterSnapshot::READ_OK, nRegs);
+  }
+  *out++ = key ? 'K' : 'D';
+  out = put_varint(out, deltaNs);
+  //count first, the changes are rarely more than a few registers
+  size_t nChanged = 0;
+  for (size_t iReg = 0; iReg < nRegs; iReg++) {
+    uint32_t value = (status[iReg] == RegisterSnapshot::READ_OK) ? values[iReg] : 0;
+    nChanged += (value != prevValues[iReg] || status[iReg] != prevStatus[iReg]);
+  }
+  out = put_varint(out, nChanged);
+  size_t last = 0;
+  for (size_t iReg = 0; nChanged > 0; iReg++) {
+    uint32_t value = (status[iReg] == RegisterSnapshot::READ_OK) ? values[iReg] : 0;
+    bool statusChanged = (status[iReg] != prevStatus[iReg]);
+    if (value == prevValues[iReg] && !statusChanged) {
+      continue;
+    }
+    out = put_varint(out, (uint64_t(iReg - last) << 1) | statusChanged);
+    if (statusChanged) {
+      *out++ = status[iReg];
+    }
+    out = put_varint(out, zigzag(value - prevValues[iReg]));
+    prevValues[iReg] = value;
+    prevStatus[iReg] = status[iReg];
+    last = iReg + 1;
+    nChanged--;
+  }
+  return out;
+}
+
+static int record(std::string const & fileName, RegisterSnapshot & snapshot,
+		  uint64_t periodNs, uint64_t samples, size_t ringSlots,
+		  uint64_t keyInterval, uint64_t maxSize) {
+  size_t nRegs = snapshot.Size();
+  TelemetryFile file;
+  if (file.Open(fileName, snapshot, periodNs, keyInterval, maxSize) < 0) {
+    return -1;
+  }
+
+  sample_ring ring;
+  ring.slots = 2;
+  while (ring.slots < ringSlots) {
+    ring.slots <<= 1;
+  }
+  ring.registers = nRegs;
+  ring.values.assign(ring.slots * nRegs, 0);
+  ring.status.assign(ring.slots * nRegs, 0);
+  ring.times.assign(ring.slots, 0);
+  ring.done.store(false, std::memory_order_relaxed);
+  ring.dropped = 0;
+  ring.late = 0;
+  ring.sampleNs = 0;
+
+  //largest record: type, two varints and every register changed
+  size_t maxRecord = 1 + 2 * 10 + nRegs * (10 + 1 + 5);
+  std::vector<uint32_t> prevValues(nRegs, 0);
+  std::vector<uint8_t> prevStatus(nRegs, RegisterSnapshot::READ_OK);
+  uint64_t startMono = 0;
+  uint64_t lastMono = 0;
+  uint64_t written = 0;
+  bool full = false;
+
+  std::thread samplerThread(sampler, &snapshot, &ring, periodNs, samples);
+  size_t mask = ring.slots - 1;
+  size_t tail = 0;
+  while (true) {
+    size_t head = ring.index.head.load(std::memory_order_acquire);
+    if (tail == head) {
+      if (ring.done.load(std::memory_order_acquire) &&
+	  tail == ring.index.head.load(std::memory_order_acquire)) {
+	break;
+      }
+      //sleep until the sampler has something or is done
+      ring.index.ConsumerWait([&ring, tail]() {
+	  return tail != ring.index.head.load(std::memory_order_acquire) ||
+	    ring.done.load(std::memory_order_acquire);
+	});
+      continue;
+    }
+    for (; tail != head; tail++) {
+      size_t slot = tail & mask;
+      if (!full) {
+	uint8_t * out = file.Reserve(maxRecord);
+	if (NULL == out) {
+	  fprintf(stderr, "Telemetry file is full, stopping\n");
+	  full = true;
+	  loop = false;
+	} else {
+	  uint64_t now = ring.times[slot];
+	  if (written == 0) {
+	    startMono = now;
+	    lastMono = now;
+	    file.SetStart(realtime_ns() - (monotonic_ns() - now));
+	  }
+	  bool key = (written % keyInterval) == 0;
+	  out = encode_sample(out, key, key ? now - startMono : now - lastMono, nRegs,
+			      &ring.values[slot * nRegs], &ring.status[slot * nRegs],
+			      &prevValues[0], &prevStatus[0]);
+	  file.Commit(out);
+	  lastMono = now;
+	  written++;
+	}
+      }
+    }
+    ring.index.tail.store(tail, std::memory_order_release);
+  }
+  samplerThread.join();
+
+  uint64_t taken = written + ring.dropped;
+  printf("%llu samples recorded, %llu dropped, %llu late\n",
+	 (unsigned long long) written, (unsigned long long) ring.dropped, (unsigned long long) ring.late);
+  if (taken) {
+    printf("%.1f us per sample, %.1f bytes per sample, %llu bytes\n",
+	   ring.sampleNs / 1000.0 / taken,
+	   written ? double(file.Size()) / written : 0.0,
+	   (unsigned long long) file.Size());
+  }
+  file.Close();
+  return 0;
+}
+
+// ====================================================================================================
+// Prints a recording, one line per register change
+static int print(std::string const & fileName) {
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", fileName.c_str(), strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  void * map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(telemetry_header)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == map) {
+    fprintf(stderr, "Failed to map %s\n", fileName.c_str());
+    return -1;
+  }
+  uint8_t const * data = (uint8_t const *) map;
+  telemetry_header const * h = (telemetry_header const *) data;
+  size_t nRegs = h->registers;
+  size_t dataOffset = h->header_size + h->names_size + 2 * nRegs * sizeof(uint32_t);
+  if (memcmp(h->magic, telemetryMagic, sizeof(telemetryMagic)) != 0 ||
+      h->version != TELEMETRY_VERSION || h->header_size != sizeof(telemetry_header) ||
+      dataOffset > size_t(st.st_size) || h->data_size > size_t(st.st_size) - dataOffset) {
+    fprintf(stderr, "%s is not a telemetry file or is from another version\n", fileName.c_str());
+    munmap(map, st.st_size);
+    return -1;
+  }
+
+  std::vector<char const *> names(nRegs);
+  char const * name = (char const *) data + h->header_size;
+  for (size_t iReg = 0; iReg < nRegs; iReg++) {
+    names[iReg] = name;
+    name += strnlen(name, h->names_size) + 1;
+  }
+  printf("# %zu registers, %llu samples, %.1f Hz\n", nRegs, (unsigned long long) h->samples,
+	 h->period_ns ? 1e9 / h->period_ns : 0.0);
+
+  std::vector<uint32_t> values(nRegs, 0);
+  std::vector<uint8_t> status(nRegs, RegisterSnapshot::READ_OK);
+  uint8_t const * in = data + dataOffset;
+  uint8_t const * end = in + h->data_size;
+  uint64_t time = 0;
+  int rc = 0;
+  while (in < end) {
+    uint8_t type = *in++;
+    uint64_t deltaNs, nChanged;
+    if ((type != 'K' && type != 'D') ||
+	NULL == (in = get_varint(in, end, deltaNs)) ||
+	NULL == (in = get_varint(in, end, nChanged))) {
+      rc = -1;
+      break;
+    }
+    if (type == 'K') {
+      time = deltaNs;
+      values.assign(nRegs, 0);
+      status.assign(nRegs, RegisterSnapshot::READ_OK);
+    } else {
+      time += deltaNs;
+    }
+    double seconds = (h->start_ns + time) / 1e9;
+    size_t iReg = 0;
+    for (uint64_t iChange = 0; iChange < nChanged; iChange++) {
+      uint64_t gap, delta;
+      if (NULL == (in = get_varint(in, end, gap))) {
+	rc = -1;
+	break;
+      }
+      iReg += gap >> 1;
+      if (iReg >= nRegs || ((gap & 0x1) && in == end)) {
+	rc = -1;
+	break;
+      }
+      if (gap & 0x1) {
+	status[iReg] = *in++;
+      }
+      if (NULL == (in = get_varint(in, end, delta))) {
+	rc = -1;
+	break;
+      }
+      values[iReg] += unzigzag(delta);
+      switch (status[iReg]) {
+      case RegisterSnapshot::READ_OK:
+	printf("%.6f %s 0x%08x\n", seconds, names[iReg], values[iReg]);
+	break;
+      case RegisterSnapshot::WRITE_ONLY:
+	printf("%.6f %s Write Only\n", seconds, names[iReg]);
+	break;
+      default:
+	printf("%.6f %s BusErr\n", seconds, names[iReg]);
+	break;
+      }
+      iReg++;
+    }
+    if (rc) {
+      break;
+    }
+  }
+  if (rc) {
+    fprintf(stderr, "%s is corrupt at byte %zu\n", fileName.c_str(),
+	    in ? size_t(in - data) : size_t(end - data));
+  }
+  munmap(map, st.st_size);
+  return rc;
+}
+
+// ====================================================================================================
+int main(int argc, char** argv) {
+
+  std::string connectionFile;
+  std::vector<std::string> regexes;
+  std::string outputFile;
+  std::string printFile;
+  double rate;
+  double duration;
+  size_t ringSlots;
+  uint64_t keyInterval;
+  uint64_t maxMB;
+
+  try {
+    TCLAP::CmdLine cmd("Records registers at a fixed rate to a delta encoded file.",
+		       ' ',
+		       "telemetry");
+    TCLAP::ValueArg<std::string> conn_file("c", //one char flag
+					   "connection_file", // full flag name
+					   "connection file", //description
+					   false, //required
+					   std::string("connections.xml"), //Default
+					   "string", //type
+					   cmd);
+    TCLAP::MultiArg<std::string> regex("r", //one char flag
+				       "regex", // full flag name
+				       "registers to record, as for read (may be repeated)", //description
+				       false, //required
+				       "string", //type
+				       cmd);
+    TCLAP::ValueArg<std::string> output("o", //one char flag
+					"output", // full flag name
+					"telemetry file", //description
+					false, //required
+					std::string("telemetry.tsr"), //Default
+					"string", //type
+					cmd);
+    TCLAP::ValueArg<double> rateArg("f", //one char flag
+				    "rate", // full flag name
+				    "samples per second", //description
+				    false, //required
+				    1000, //Default
+				    "Hz", //type
+				    cmd);
+    TCLAP::ValueArg<double> durationArg("d", //one char flag
+					"duration", // full flag name
+					"seconds to record, 0 until SIGINT", //description
+					false, //required
+					0, //Default
+					"seconds", //type
+					cmd);
+    TCLAP::ValueArg<size_t> ringArg("b", //one char flag
+				    "ring", // full flag name
+				    "samples buffered between sampling and the file", //description
+				    false, //required
+				    4096, //Default
+				    "samples", //type
+				    cmd);
+    TCLAP::ValueArg<uint64_t> keyArg("k", //one char flag
+				     "key_interval", // full flag name
+				     "samples between key records", //description
+				     false, //required
+				     1000, //Default
+				     "samples", //type
+				     cmd);
+    TCLAP::ValueArg<uint64_t> maxArg("m", //one char flag
+				     "max_size", // full flag name
+				     "largest telemetry file, 0 for no limit", //description
+				     false, //required
+				     1024, //Default
+				     "MB", //type
+				     cmd);
+    TCLAP::ValueArg<std::string> printArg("p", //one char flag
+					  "print", // full flag name
+					  "print the changes in a telemetry file and exit", //description
+					  false, //required
+					  std::string(""), //Default
+					  "string", //type
+					  cmd);
+    cmd.parse(argc, argv);
+
+    connectionFile = conn_file.getValue();
+    regexes = regex.getValue();
+    outputFile = output.getValue();
+    printFile = printArg.getValue();
+    rate = rateArg.getValue();
+    duration = durationArg.getValue();
+    ringSlots = ringArg.getValue();
+    keyInterval = keyArg.getValue();
+    maxMB = maxArg.getValue();
+  } catch (TCLAP::ArgException &e) {
+    fprintf(stderr, "Failed to Parse Command Line\n");
+    return -1;
+  }
+
+  if (!printFile.empty()) {
+    return print(printFile) == 0 ? 0 : -1;
+  }
+  if (regexes.empty()) {
+    fprintf(stderr, "No registers given, use -r\n");
+    return -1;
+  }
+  if (rate <= 0 || rate > 100000) {
+    fprintf(stderr, "Rate must be above 0 and at most 100 kHz\n");
+    return -1;
+  }
+  if (keyInterval == 0) {
+    keyInterval = 1;
+  }
+
+  // ====================================
+  // Signal handling
+  struct sigaction sa_INT, sa_TERM;
+  memset(&sa_INT, 0, sizeof(sa_INT));
+  memset(&sa_TERM, 0, sizeof(sa_TERM));
+  sa_INT.sa_handler = signal_handler;
+  sa_TERM.sa_handler = signal_handler;
+  sigemptyset(&sa_INT.sa_mask);
+  sigemptyset(&sa_TERM.sa_mask);
+  sigaction(SIGINT,  &sa_INT , NULL);
+  sigaction(SIGTERM, &sa_TERM, NULL);
+  loop = true;
+
+  int rc = 0;
+  ApolloSM * SM = NULL;
+  try {
+    SM = new ApolloSM();
+    std::vector<std::string> arg;
+    arg.push_back(connectionFile);
+    SM->Connect(arg);
+
+    //registers of every regex, each one once, in address table order
+    std::vector<std::string> registers;
+    std::set<std::string> seen;
+    for (size_t iRegex = 0; iRegex < regexes.size(); iRegex++) {
+      std::vector<std::string> matches = SM->myMatchRegex(regexes[iRegex]);
+      for (size_t iMatch = 0; iMatch < matches.size(); iMatch++) {
+	if (seen.insert(matches[iMatch]).second) {
+	  registers.push_back(matches[iMatch]);
+	}
+      }
+    }
+
+    RegisterSnapshot snapshot(SM->GetHWInterface());
+    size_t readable = snapshot.Build(registers);
+    if (readable == 0) {
+      fprintf(stderr, "No readable registers match\n");
+      rc = -1;
+    } else {
+      uint64_t periodNs = uint64_t(1e9 / rate);
+      uint64_t samples = 0;
+      if (duration > 0) {
+	//rounded up, 0 would mean until SIGINT
+	samples = uint64_t(ceil(duration * rate - 1e-6));
+	if (samples == 0) {
+	  samples = 1;
+	}
+      }
+      printf("Recording %zu registers (%zu blocks) at %.1f Hz to %s\n",
+	     snapshot.Size(), snapshot.Blocks(), rate, outputFile.c_str());
+      fflush(stdout);
+      rc = record(outputFile, snapshot, periodNs, samples, ringSlots,
+		  keyInterval, maxMB << 20);
+    }
+  } catch (BUException::exBase const & e) {
+    fprintf(stderr, "Caught BUException: %s\n   Info: %s\n", e.what(), e.Description());
+    rc = -1;
+  } catch (std::exception const & e) {
+    fprintf(stderr, "Caught std::exception: %s\n", e.what());
+    rc = -1;
+  }
+
+  if (NULL != SM) {
+    delete SM;
+  }
+  return rc;
+}
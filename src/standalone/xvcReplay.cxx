@@ -0,0 +1,331 @@
+/*
+ * xvcReplay: plays the messages an XVC client sent, as recorded by
+ * xvcServer --capture (a file per client) or the client half of a
+ * socat/tcpdump capture of a Vivado session, through the same shift loop
+ * xvcServer runs (xvc_shift_vector) and prints the shift rate.
+ *
+ * By default the shifts go into a register block in memory served by a core
+ * thread that finishes every shift at once and loops TDI back to TDO, so the
+ * times are the shift loop's own and every TDO is checked.  With -f they go
+ * to a running jtagSim instead, without TDO checks.  -m writes a synthetic
+ * capture first for trying this out without a Vivado session.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+
+//TCLAP parser
+#include <tclap/CmdLine.h>
+
+#include <ApolloSM/axiJTAG.hh>
+#include <standalone/xvcShift.hh>
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t & state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+//A Vivado-like session, getinfo and settck then shifts of shiftBits until
+//megabits are written
+static int generate_capture(std::string const & captureFile, double megabits, int shiftBits) {
+  FILE * out = fopen(captureFile.c_str(), "w");
+  if (out == NULL) {
+    fprintf(stderr, "Failed to create %s: %s\n", captureFile.c_str(), strerror(errno));
+    return -1;
+  }
+  fwrite("getinfo:", 1, 8, out);
+  uint32_t period = 100; //ns
+  fwrite("settck:", 1, 7, out);
+  fwrite(&period, 1, 4, out);
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  std::vector<unsigned char> vector;
+  uint64_t totalBits = megabits * 1E6;
+  for (uint64_t bits = 0; bits < totalBits; bits += shiftBits) {
+    int32_t len = shiftBits;
+    if (totalBits - bits < (uint64_t) len) {
+      len = totalBits - bits;
+    }
+    size_t nBytes = (len + 7) / 8;
+    vector.resize(2*nBytes);
+    for (size_t iByte = 0; iByte < vector.size(); iByte++) {
+      vector[iByte] = xorshift64(state);
+    }
+    fwrite("shift:", 1, 6, out);
+    fwrite(&len, 1, 4, out);
+    fwrite(&vector[0], 1, vector.size(), out);
+  }
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Failed to write %s\n", captureFile.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+static int read_capture(std::string const & captureFile, std::vector<unsigned char> & data) {
+  FILE * in = fopen(captureFile.c_str(), "r");
+  if (in == NULL) {
+    fprintf(stderr, "Failed to open %s: %s\n", captureFile.c_str(), strerror(errno));
+    return -1;
+  }
+  unsigned char buffer[0x10000];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  bool failed = ferror(in);
+  fclose(in);
+  if (failed) {
+    fprintf(stderr, "Failed to read %s\n", captureFile.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+//Offsets of the shift: messages in the capture, getinfo: and settck: are skipped
+static int find_shifts(std::vector<unsigned char> const & data, std::vector<size_t> & shifts) {
+  size_t offset = 0;
+  while (offset < data.size()) {
+    unsigned char const * cmd = &data[offset];
+    size_t avail = data.size() - offset;
+    size_t size;
+    if (avail >= 8 && memcmp(cmd, "getinfo:", 8) == 0) {
+      size = 8;
+    } else if (avail >= 7 && memcmp(cmd, "settck:", 7) == 0) {
+      size = 11;
+    } else if (avail >= 6 && memcmp(cmd, "shift:", 6) == 0) {
+      if (avail < 10) {
+	size = 10;
+      } else {
+	int32_t len;
+	memcpy(&len, cmd + 6, 4);
+	if (len < 0) {
+	  fprintf(stderr, "Invalid shift length %d at byte %zu.\n", len, offset);
+	  return -1;
+	}
+	size = 10 + 2*(((size_t) len + 7) / 8);
+      }
+      if (size <= avail) {
+	shifts.push_back(offset);
+      }
+    } else {
+      fprintf(stderr, "Invalid message '%.*s' at byte %zu.\n", (int) (avail < 8 ? avail : 8), cmd, offset);
+      return -1;
+    }
+    if (size > avail) {
+      //the capture stopped in the middle of a message
+      fprintf(stderr, "Ignoring the truncated message at byte %zu.\n", offset);
+      break;
+    }
+    offset += size;
+  }
+  return 0;
+}
+
+//A core that finishes each shift as soon as it sees it, TDO is TDI
+static void loopback_core(axi_jtag_regs volatile * regs, std::atomic<bool> * running) {
+  unsigned idle = 0;
+  while (running->load(std::memory_order_relaxed)) {
+    if (regs->ctrl == 0) {
+      if (++idle >= 256) {
+	idle = 0;
+	//the replay may share our CPU
+	sched_yield();
+      }
+      continue;
+    }
+    idle = 0;
+    __sync_synchronize();
+    uint32_t length = regs->length;
+    uint32_t mask = (length >= 32) ? 0xFFFFFFFF : ((1UL << length) - 1);
+    regs->tdo = regs->tdi & mask;
+    __sync_synchronize();
+    regs->ctrl = 0;
+  }
+}
+
+//TDO of a loopback core is TDI with the bits past len cleared
+static bool loopback_match(unsigned char const * tdi, unsigned char const * tdo, int len) {
+  size_t nBytes = (len + 7) / 8;
+  if (nBytes == 0) {
+    return true;
+  }
+  if (memcmp(tdi, tdo, nBytes - 1) != 0) {
+    return false;
+  }
+  unsigned char mask = (len & 0x7) ? ((1 << (len & 0x7)) - 1) : 0xFF;
+  return (tdi[nBytes - 1] & mask) == tdo[nBytes - 1];
+}
+
+int main(int argc, char ** argv) {
+  std::string captureFile;
+  std::string simFile;
+  double megabits;
+  int shiftBits;
+  int repeat;
+  try {
+    TCLAP::CmdLine cmd("Replays captured XVC traffic through xvcServer's shift loop.",
+		       ' ',
+		       "xvcReplay");
+    TCLAP::ValueArg<std::string> replayCapture("c",              //one char flag
+					       "capture",      // full flag name
+					       "messages an XVC client sent, e.g. from xvcServer --capture",//description
+					       true,            //required
+					       std::string(""),  //Default
+					       "path",         // type
+					       cmd);
+    TCLAP::ValueArg<std::string> replaySimFile("f",              //one char flag
+					       "file",      // full flag name
+					       "register file of a running jtagSim instead of the built-in core",//description
+					       false,            //required
+					       std::string(""),  //Default
+					       "path",         // type
+					       cmd);
+    TCLAP::ValueArg<double> replayMegabits("m",              //one char flag
+					   "megabits",      // full flag name
+					   "first write a synthetic capture with this much shift data",//description
+					   false,            //required
+					   0,  //Default
+					   "Mbit",         // type
+					   cmd);
+    TCLAP::ValueArg<int> replayShiftBits("s",              //one char flag
+					 "shift-bits",      // full flag name
+					 "bits of each synthetic shift",//description
+					 false,            //required
+					 8*(0x10000/2),  //Default, the largest with xvcServer's default vector size
+					 "bits",         // type
+					 cmd);
+    TCLAP::ValueArg<int> replayRepeat("n",              //one char flag
+				      "repeat",      // full flag name
+				      "times to play the capture",//description
+				      false,            //required
+				      1,  //Default
+				      "n",         // type
+				      cmd);
+
+    //Parse the command line arguments
+    cmd.parse(argc,argv);
+    captureFile = replayCapture.getValue();
+    simFile = replaySimFile.getValue();
+    megabits = replayMegabits.getValue();
+    shiftBits = replayShiftBits.getValue();
+    repeat = replayRepeat.getValue();
+  }catch (TCLAP::ArgException &e) {
+    fprintf(stderr, "Error %s for arg %s\n",
+	    e.error().c_str(), e.argId().c_str());
+    return 1;
+  }
+  if (shiftBits < 1 || repeat < 1) {
+    fprintf(stderr, "Need at least one bit per shift and one pass.\n");
+    return 1;
+  }
+
+  if (megabits > 0 && generate_capture(captureFile, megabits, shiftBits) < 0) {
+    return 1;
+  }
+  std::vector<unsigned char> data;
+  std::vector<size_t> shifts;
+  if (read_capture(captureFile, data) < 0 || find_shifts(data, shifts) < 0) {
+    return 1;
+  }
+  if (shifts.empty()) {
+    fprintf(stderr, "No shift: messages in %s.\n", captureFile.c_str());
+    return 1;
+  }
+
+  //the core
+  axi_jtag_regs volatile * regs;
+  axi_jtag_regs memRegs;
+  memset(&memRegs, 0, sizeof(memRegs));
+  std::atomic<bool> running(true);
+  std::thread core;
+  if (simFile.empty()) {
+    regs = &memRegs;
+    core = std::thread(loopback_core, regs, &running);
+  } else {
+    regs = axi_jtag_map_file(simFile);
+    if (regs == NULL) {
+      return 1;
+    }
+  }
+  auto busy = [regs]() {
+    if (regs->ctrl == 0) {
+      return false;
+    }
+    //the core may share our CPU
+    sched_yield();
+    return true;
+  };
+  auto wait = [&busy]() {
+    while (busy()) {
+    }
+  };
+  auto trace = [](int, uint32_t, uint32_t, uint32_t) {};
+
+  std::vector<unsigned char> tdo;
+  uint64_t bits = 0;
+  uint64_t words = 0;
+  uint64_t mismatches = 0;
+  uint64_t start = now_ns();
+  for (int iPass = 0; iPass < repeat; iPass++) {
+    for (size_t iShift = 0; iShift < shifts.size(); iShift++) {
+      unsigned char const * cmd = &data[shifts[iShift]];
+      int32_t len;
+      memcpy(&len, cmd + 6, 4);
+      size_t nBytes = (len + 7) / 8;
+      unsigned char const * tms = cmd + 10;
+      unsigned char const * tdi = tms + nBytes;
+      if (tdo.size() < nBytes + 4) {
+	tdo.resize(nBytes + 4);
+      }
+      xvc_shift_vector<false>(regs, true, wait, trace, tms, tdi, &tdo[0], len);
+      bits += len;
+      words += (len + 31) / 32;
+      if (simFile.empty() && !loopback_match(tdi, &tdo[0], len)) {
+	if (mismatches == 0) {
+	  fprintf(stderr, "TDO mismatch in shift %zu of %d bits at byte %zu.\n",
+		  iShift, len, shifts[iShift]);
+	}
+	mismatches++;
+      }
+    }
+  }
+  double seconds = 1E-9 * (now_ns() - start);
+
+  if (simFile.empty()) {
+    running = false;
+    core.join();
+  } else {
+    axi_jtag_unmap_file(regs);
+  }
+
+  uint64_t nShifts = repeat * shifts.size();
+  printf("%llu shifts, %llu bits, %llu words in %.3f s\n",
+	 (unsigned long long) nShifts, (unsigned long long) bits, (unsigned long long) words, seconds);
+  if (seconds > 0) {
+    printf("%.2f Mbit/s, %.2f us per shift, %.1f ns per word\n",
+	   1E-6 * bits / seconds, 1E6 * seconds / nShifts, (words > 0) ? 1E9 * seconds / words : 0.0);
+  }
+  if (mismatches > 0) {
+    fprintf(stderr, "%llu shifts came back wrong.\n", (unsigned long long) mismatches);
+    return 1;
+  }
+  return 0;
+}
@@ -21,226 +21,1066 @@
 #include <sys/socket.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h> 
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
                                                                                                                                                 
 #include <syslog.h>
 #include <errno.h>
 
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
 #include <string>
 
 //TCLAP parser
 #include <tclap/CmdLine.h>
 
 #include <standalone/uioLabelFinder.hh>
+#include <standalone/xvcShift.hh>
+#include <ApolloSM/uioIRQ.hh>
+#include <ApolloSM/axiJTAG.hh>
 
 extern int errno;
 
 #define MAP_SIZE      0x10000
 
-typedef struct  {
-  uint32_t length_offset;
-  uint32_t tms_offset;
-  uint32_t tdi_offset;
-  uint32_t tdo_offset;
-  uint32_t ctrl_offset;
-} sXVC;
+static int verbose = 0;
 
-sXVC volatile * pXVC = NULL;
+//Largest shift: vector in bytes, TMS and TDI together, as reported by getinfo
+#define DEFAULT_VECTOR_SIZE 0x10000
+#define MIN_VECTOR_SIZE     8
+#define MAX_VECTOR_SIZE     0x1000000
+static size_t vectorSize = DEFAULT_VECTOR_SIZE;
+static char xvcInfo[64];
 
-static int verbose = 0;
+static long jtagLockTimeout = 0; //ms, 0 holds the core until disconnect
+static int sockBufSize = 0;      //client socket buffers, 0 leaves the kernel's
+static std::string capturePath;  //each client's messages go to <path>.<port>.<client port>, empty for none
+
+/*
+ * Statistics
+ *
+ * Each core's thread is the only writer of its counters and histograms, so
+ * updates are plain relaxed load/store pairs on atomics and the stats thread
+ * reads them without stopping anything.  The histograms are log-linear like
+ * HDR histograms: exact below 32ns, then 16 buckets per power of two (about 6%
+ * resolution).  The report goes to --stats-socket on every connection and
+ * to --stats-file every --stats-interval seconds.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_LINEAR   (2 << HIST_SUB_BITS)
+#define HIST_BUCKETS  (HIST_LINEAR + (64 - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS))
+
+static inline void stat_add(std::atomic<uint64_t> & counter, uint64_t n) {
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct xvc_histogram {
+  std::atomic<uint64_t> counts[HIST_BUCKETS];
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> max;
+
+  xvc_histogram() {
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+      counts[i].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+  }
+  static size_t bucket(uint64_t v) {
+    if (v < HIST_LINEAR) {
+      return v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    return HIST_LINEAR + (msb - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS) +
+      ((v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+  }
+  //highest value that lands in bucket i
+  static uint64_t bucket_top(size_t i) {
+    if (i < HIST_LINEAR) {
+      return i;
+    }
+    int msb = (i - HIST_LINEAR) / (1 << HIST_SUB_BITS) + HIST_SUB_BITS + 1;
+    uint64_t sub = (i - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+    uint64_t low = (1ULL << msb) | (sub << (msb - HIST_SUB_BITS));
+    return low + (1ULL << (msb - HIST_SUB_BITS)) - 1;
+  }
+  void record(uint64_t v) {
+    stat_add(counts[bucket(v)], 1);
+    stat_add(total, 1);
+    stat_add(sum, v);
+    if (v > max.load(std::memory_order_relaxed)) {
+      max.store(v, std::memory_order_relaxed);
+    }
+  }
+  uint64_t percentile(double p) const {
+    uint64_t n = total.load(std::memory_order_relaxed);
+    uint64_t rank = p * n;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+      seen += counts[i].load(std::memory_order_relaxed);
+      if (seen > rank) {
+	uint64_t top = bucket_top(i);
+	uint64_t m = max.load(std::memory_order_relaxed);
+	return (top < m) ? top : m;
+      }
+    }
+    return max.load(std::memory_order_relaxed);
+  }
+};
+
+//Clients with a slot get their own line in the report, the rest only count in the core totals
+#define CLIENT_SLOTS 16
+struct xvc_client_stats {
+  std::atomic<bool> active;
+  std::atomic<uint32_t> addr;   //IPv4, network order
+  std::atomic<uint32_t> port;
+  std::atomic<uint64_t> since_ns;
+  std::atomic<uint64_t> bytes_in;
+  std::atomic<uint64_t> bytes_out;
+  std::atomic<uint64_t> shifts;
+  std::atomic<uint64_t> bits;
+};
+
+struct xvc_stats {
+  std::atomic<uint64_t> connections;
+  std::atomic<uint64_t> active;
+  std::atomic<uint64_t> getinfos;
+  std::atomic<uint64_t> settcks;
+  std::atomic<uint64_t> shifts;
+  std::atomic<uint64_t> words;
+  std::atomic<uint64_t> bits;
+  std::atomic<uint64_t> bytes_in;
+  std::atomic<uint64_t> bytes_out;
+  std::atomic<uint64_t> lock_waits;
+  xvc_histogram shift_ns;      //whole shift received to its TDO sent
+  xvc_histogram jtag_ns;       //shifting through the core
+  xvc_histogram go_ns;         //per word wait on the core, only with a stats endpoint
+  xvc_histogram receive_ns;    //first to last byte of a message, TCP and client pacing
+  xvc_histogram turnaround_ns; //reply sent to the next message starting, network round trip
+  xvc_histogram lock_ns;       //shifts waiting for another client's lock
+  xvc_client_stats clients[CLIENT_SLOTS];
 
-static int sread(int fd, void *target, int len) {
-  unsigned char *t = (unsigned char *) target;
-  while (len) {
-    int r = read(fd, t, len);
-    if (r <= 0)
-      return r;
-    t += r;
-    len -= r;
+  xvc_stats() {
+    std::atomic<uint64_t> * counters[] = {&connections, &active, &getinfos, &settcks, &shifts,
+					 &words, &bits, &bytes_in, &bytes_out, &lock_waits};
+    for (size_t i = 0; i < sizeof(counters)/sizeof(counters[0]); i++) {
+      counters[i]->store(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < CLIENT_SLOTS; i++) {
+      clients[i].active.store(false, std::memory_order_relaxed);
+    }
   }
-  return 1;
+};
+
+//Set when there is a stats endpoint, turns on the per word GO timing
+static bool statsEnabled = false;
+
+//labels are jtagSim register files instead of UIO labels
+static bool mockCores = false;
+
+struct xvc_conn;
+
+//A JTAG core and its clients, each core is served by its own thread
+struct xvc_core {
+  std::string label;
+  int port;
+  int cpu;                  //CPU the thread is pinned to, -1 for none
+  axi_jtag_regs volatile * regs;
+  UIOIRQ irq;               //completion of a shift, spins and then sleeps on the interrupt with --irq
+  int listenFd;
+  int epfd;
+  std::vector<xvc_conn *> closedConns; //freed after the epoll batch
+  xvc_conn * jtagOwner;
+  std::deque<xvc_conn *> jtagQueue;
+  struct timespec jtagLastShift;
+  xvc_stats stats;
+};
+
+static void trace_word(int length, uint32_t tms, uint32_t tdi, uint32_t tdo) {
+  printf("LEN : 0x%08x\n", length);
+  syslog(LOG_ERR,"LEN : 0x%08x\n", length);
+  printf("TMS : 0x%08x\n", tms);
+  syslog(LOG_ERR,"TMS : 0x%08x\n", tms);
+  printf("TDI : 0x%08x\n", tdi);
+  syslog(LOG_ERR,"TDI : 0x%08x\n", tdi);
+  printf("TDO : 0x%08x\n", tdo);
+  syslog(LOG_ERR,"TDO : 0x%08x\n", tdo);
 }
 
-int handle_data(int fd) {
+//Shifts len bits of TMS/TDI through the core, see xvc_shift_vector.
+//With Verbose false the trace is compiled out.
+template<bool Verbose>
+static void shift_vector(xvc_core * core,
+			 unsigned char const * tmsBytes, unsigned char const * tdiBytes,
+			 unsigned char * result, int len) {
+  axi_jtag_regs volatile * pXVC = core->regs;
+  auto busy = [pXVC]() {
+    if (pXVC->ctrl == 0) {
+      return false;
+    }
+    if (mockCores) {
+      //jtagSim may share our CPU
+      sched_yield();
+    }
+    return true;
+  };
+  auto wait = [core, &busy]() {
+    uint64_t waitStart = statsEnabled ? now_ns() : 0;
+    core->irq.WaitFor(busy);
+    if (statsEnabled) {
+      core->stats.go_ns.record(now_ns() - waitStart);
+    }
+  };
+  //the simulated registers are ordinary shared memory
+  xvc_shift_vector<Verbose>(pXVC, mockCores, wait, trace_word, tmsBytes, tdiBytes, result, len);
+}
+
+/*
+ * Connections
+ *
+ * Every client is non-blocking and driven by epoll.  A connection receives
+ * as much as the socket holds into its input buffer with one recv(), so a
+ * shift's header and TMS/TDI bytes normally arrive together, and messages
+ * are parsed in place.  Shifts write their TDO straight into the output
+ * buffer; the replies of all the messages handled in one go are queued as
+ * iovecs and leave in a single sendmsg().  A slow client only holds up
+ * itself.  The states are:
+ *   XVC_READ      handling received messages, receiving more
+ *   XVC_WAIT_JTAG the shift at the start of the input buffer is waiting for
+ *                 the JTAG core, nothing more is handled or received
+ *
+ * Shifts from different clients of a JTAG core must not be interleaved.
+ * The first client to shift owns the core until it
+ * disconnects; other clients with a shift queue up in arrival order.  With a
+ * lock timeout, an owner that has not shifted for that long hands the core to
+ * the next queued client and has to queue again for its next shift.
+ * getinfo and settck never need the core.
+ */
+enum xvc_state {XVC_READ, XVC_WAIT_JTAG};
+
+struct xvc_conn {
+  xvc_core * core;
+  int fd;
+  xvc_state state;
+  uint32_t events;                 //what epoll waits for
+  std::vector<unsigned char> in;   //received bytes
+  size_t rx_start;                 //start of the first unhandled message
+  size_t rx_end;
+  std::vector<unsigned char> out;  //TDO and settck replies
+  size_t out_end;
+  std::vector<struct iovec> iov;   //replies not sent yet, in order
+  size_t iov_done;                 //iovecs already sent
+  std::vector<uint64_t> sending_shifts; //shift_ready_ns of the shifts in iov
+  int slot;                  //client stats slot, -1 without one
+  bool queued;               //the shift waited for the lock
+  bool peer_closed;          //the client shut down its side while queued
+  uint64_t msg_start_ns;     //first byte of the current message
+  uint64_t shift_ready_ns;   //the whole shift arrived
+  uint64_t reply_done_ns;    //the last reply went out
+  FILE * capture;            //what this client sends, for xvcReplay, NULL for none
+};
 
-  const char xvcInfo[] = "xvcServer_v1.0:2048\n"; 
+static long ms_since(struct timespec const & then) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - then.tv_sec)*1000 + (now.tv_nsec - then.tv_nsec)/1000000;
+}
 
-  do {
-    char cmd[16];
-    unsigned char buffer[2048], result[1024];
-    memset(cmd, 0, 16);
+static bool conn_sending(xvc_conn const * c) {
+  return c->iov_done < c->iov.size();
+}
 
-    if (sread(fd, cmd, 2) != 1)
-      return 1;
+static void conn_watch(xvc_conn * c) {
+  uint32_t events = EPOLLIN;
+  if (c->state == XVC_WAIT_JTAG) {
+    //only hang ups, the next message stays in the socket.  Once the client
+    //has shut down its side nothing is watched, EPOLLHUP/EPOLLERR still come
+    events = c->peer_closed ? 0 : (uint32_t) EPOLLRDHUP;
+  }
+  if (conn_sending(c)) {
+    //nothing more is handled until the replies are out
+    events = (events & ~EPOLLIN) | EPOLLOUT;
+  }
+  if (events != c->events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(c->core->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+  }
+}
 
-    if (memcmp(cmd, "ge", 2) == 0) {
-      if (sread(fd, cmd, 6) != 1)
-	return 1;
-      memcpy(result, xvcInfo, strlen(xvcInfo));
-      ssize_t writeRet = write(fd, result, strlen(xvcInfo));
-      if ((writeRet < 0) || (((size_t)writeRet) != strlen(xvcInfo))) {
-	perror("write");
-	return 1;
-      }
-      if (verbose) {
-	printf("%u : Received command: 'getinfo'\n", (int)time(NULL));
-	syslog(LOG_ERR,"%u : Received command: 'getinfo'\n", (int)time(NULL));
-	printf("\t Replied with %s\n", xvcInfo);
-	syslog(LOG_ERR,"\t Replied with %s\n", xvcInfo);
-      }
-      break;
-    } else if (memcmp(cmd, "se", 2) == 0) {
-      if (sread(fd, cmd, 9) != 1)
-	return 1;
-      memcpy(result, cmd + 5, 4);
-      if (write(fd, result, 4) != 4) {
-	perror("write");
-	return 1;
-      }
-      if (verbose) {
-	printf("%u : Received command: 'settck'\n", (int)time(NULL));
-	syslog(LOG_ERR,"%u : Received command: 'settck'\n", (int)time(NULL));
-	printf("\t Replied with '%.*s'\n\n", 4, cmd + 5);
-	syslog(LOG_ERR,"\t Replied with '%.*s'\n\n", 4, cmd + 5);
-      }
-      break;
-    } else if (memcmp(cmd, "sh", 2) == 0) {
-      if (sread(fd, cmd, 4) != 1)
-	return 1;
-      if (verbose) {
-	printf("%u : Received command: 'shift'\n", (int)time(NULL));
-	syslog(LOG_ERR,"%u : Received command: 'shift'\n", (int)time(NULL));
+//Queues a reply, data has to stay put until it is sent
+static void conn_reply(xvc_conn * c, void const * data, size_t size) {
+  if (!c->iov.empty() &&
+      (char const *) c->iov.back().iov_base + c->iov.back().iov_len == data) {
+    c->iov.back().iov_len += size;
+    return;
+  }
+  struct iovec reply;
+  reply.iov_base = (void *) data;
+  reply.iov_len = size;
+  c->iov.push_back(reply);
+}
+
+//Sends the queued replies, false closes the connection
+static bool conn_flush(xvc_conn * c) {
+  while (conn_sending(c)) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &c->iov[c->iov_done];
+    msg.msg_iovlen = c->iov.size() - c->iov_done;
+    ssize_t r = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+    if (r < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	return true;
+      } else if (errno == EINTR) {
+	continue;
       }
-    } else {
+      perror("write");
+      return false;
+    }
+    xvc_stats & stats = c->core->stats;
+    stat_add(stats.bytes_out, r);
+    if (c->slot >= 0) {
+      stat_add(stats.clients[c->slot].bytes_out, r);
+    }
+    //skip what went out
+    size_t sent = r;
+    while (sent > 0 && sent >= c->iov[c->iov_done].iov_len) {
+      sent -= c->iov[c->iov_done].iov_len;
+      c->iov_done++;
+    }
+    if (sent > 0) {
+      c->iov[c->iov_done].iov_base = (char *) c->iov[c->iov_done].iov_base + sent;
+      c->iov[c->iov_done].iov_len -= sent;
+    }
+  }
+  if (c->iov_done > 0) {
+    xvc_stats & stats = c->core->stats;
+    c->reply_done_ns = now_ns();
+    for (size_t iShift = 0; iShift < c->sending_shifts.size(); iShift++) {
+      stats.shift_ns.record(c->reply_done_ns - c->sending_shifts[iShift]);
+    }
+    c->sending_shifts.clear();
+    c->iov.clear();
+    c->iov_done = 0;
+    c->out_end = 0;
+  }
+  return true;
+}
 
-      fprintf(stderr, "invalid cmd '%s'\n", cmd);
-      syslog(LOG_ERR,"invalid cmd '%s'\n", cmd);
-      return 1;
+//Size of the message at the start of the input buffer, 0 until enough of it
+//is here to tell, -1 if it is invalid
+static long conn_message_size(xvc_conn * c) {
+  unsigned char const * cmd = &c->in[c->rx_start];
+  size_t avail = c->rx_end - c->rx_start;
+  if (avail < 2) {
+    return 0;
+  }
+  if (memcmp(cmd, "ge", 2) == 0) {
+    return 8;
+  } else if (memcmp(cmd, "se", 2) == 0) {
+    return 11;
+  } else if (memcmp(cmd, "sh", 2) != 0) {
+    fprintf(stderr, "invalid cmd '%.2s'\n", cmd);
+    syslog(LOG_ERR,"invalid cmd '%.2s'\n", cmd);
+    return -1;
+  }
+  if (avail < 10) {
+    return 0;
+  }
+  int len;
+  memcpy(&len, cmd + 6, 4);
+  if (len < 0) {
+    fprintf(stderr, "invalid shift length %d\n", len);
+    syslog(LOG_ERR,"invalid shift length %d\n", len);
+    return -1;
+  }
+  size_t nr_bytes = ((size_t) len + 7) / 8;
+  if (nr_bytes * 2 > vectorSize) {
+    fprintf(stderr, "buffer size exceeded\n");
+    syslog(LOG_ERR,"buffer size exceeded\n");
+    return -1;
+  }
+  return 10 + 2*nr_bytes;
+}
+
+//Drops the handled message at the start of the input buffer
+static void conn_consume(xvc_conn * c, size_t size) {
+  if (c->capture != NULL) {
+    fwrite(&c->in[c->rx_start], 1, size, c->capture);
+  }
+  c->rx_start += size;
+  if (c->rx_start == c->rx_end) {
+    c->rx_start = c->rx_end = 0;
+  } else {
+    //the next message is already here
+    c->msg_start_ns = now_ns();
+  }
+}
+
+//Runs the shift at the start of the input buffer, the caller owns the core
+//and made room for the TDO
+static void conn_shift(xvc_conn * c) {
+  xvc_core * core = c->core;
+  unsigned char const * cmd = &c->in[c->rx_start];
+  int len;
+  memcpy(&len, cmd + 6, 4);
+  int nr_bytes = (len + 7) / 8;
+  unsigned char const * tms = cmd + 10;
+  unsigned char * tdo = &c->out[c->out_end];
+  uint64_t start = now_ns();
+  if (c->queued) {
+    core->stats.lock_ns.record(start - c->shift_ready_ns);
+    c->queued = false;
+  }
+  if (verbose) {
+    shift_vector<true>(core, tms, tms + nr_bytes, tdo, len);
+  } else {
+    shift_vector<false>(core, tms, tms + nr_bytes, tdo, len);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &core->jtagLastShift);
+  core->stats.jtag_ns.record(now_ns() - start);
+  stat_add(core->stats.shifts, 1);
+  stat_add(core->stats.words, (len + 31) / 32);
+  stat_add(core->stats.bits, len);
+  if (c->slot >= 0) {
+    stat_add(core->stats.clients[c->slot].shifts, 1);
+    stat_add(core->stats.clients[c->slot].bits, len);
+  }
+  c->out_end += nr_bytes;
+  conn_reply(c, tdo, nr_bytes);
+  c->sending_shifts.push_back(c->shift_ready_ns);
+  conn_consume(c, 10 + 2*nr_bytes);
+}
+
+//Handles the complete message at the start of the input buffer.
+//Returns 1 when it is done, 0 when it has to wait for the replies before it
+//to go out or for the JTAG core, -1 to close the connection.
+static int conn_message(xvc_conn * c, size_t size) {
+  unsigned char * cmd = &c->in[c->rx_start];
+
+  if (memcmp(cmd, "ge", 2) == 0) {
+    stat_add(c->core->stats.getinfos, 1);
+    //straight from the string, no copy
+    conn_reply(c, xvcInfo, strlen(xvcInfo));
+    if (verbose) {
+      printf("%u : Received command: 'getinfo'\n", (int)time(NULL));
+      syslog(LOG_ERR,"%u : Received command: 'getinfo'\n", (int)time(NULL));
+      printf("\t Replied with %s\n", xvcInfo);
+      syslog(LOG_ERR,"\t Replied with %s\n", xvcInfo);
+    }
+    conn_consume(c, size);
+    return 1;
+  }
+
+  //settck and shift replies go into the output buffer
+  size_t replySize = (memcmp(cmd, "se", 2) == 0) ? 4 : (size - 10) / 2;
+  if (c->out_end + replySize > c->out.size()) {
+    if (!conn_flush(c)) {
+      return -1;
+    }
+    if (conn_sending(c)) {
+      return 0;
+    }
+  }
+
+  if (memcmp(cmd, "se", 2) == 0) {
+    stat_add(c->core->stats.settcks, 1);
+    memcpy(&c->out[c->out_end], cmd + 7, 4);
+    conn_reply(c, &c->out[c->out_end], 4);
+    c->out_end += 4;
+    if (verbose) {
+      printf("%u : Received command: 'settck'\n", (int)time(NULL));
+      syslog(LOG_ERR,"%u : Received command: 'settck'\n", (int)time(NULL));
+      printf("\t Replied with '%.*s'\n\n", 4, cmd + 7);
+      syslog(LOG_ERR,"\t Replied with '%.*s'\n\n", 4, cmd + 7);
     }
+    conn_consume(c, size);
+    return 1;
+  }
 
+  if (verbose) {
     int len;
-    if (sread(fd, &len, 4) != 1) {
-      fprintf(stderr, "reading length failed\n");
-      syslog(LOG_ERR,"reading length failed\n");
-      return 1;
+    memcpy(&len, cmd + 6, 4);
+    printf("%u : Received command: 'shift'\n", (int)time(NULL));
+    syslog(LOG_ERR,"%u : Received command: 'shift'\n", (int)time(NULL));
+    printf("\tNumber of Bits  : %d\n", len);
+    syslog(LOG_ERR,"\tNumber of Bits  : %d\n", len);
+    printf("\tNumber of Bytes : %d \n", (int) replySize);
+    syslog(LOG_ERR,"\tNumber of Bytes : %d \n", (int) replySize);
+    printf("\n");
+    syslog(LOG_ERR,"\n");
+  }
+
+  //the whole shift is here
+  xvc_core * core = c->core;
+  c->shift_ready_ns = now_ns();
+  core->stats.receive_ns.record(c->shift_ready_ns - c->msg_start_ns);
+  if (core->jtagOwner == NULL) {
+    core->jtagOwner = c;
+    if (verbose) {
+      printf("%s: fd %d owns the JTAG core\n", core->label.c_str(), c->fd);
     }
+  }
+  if (core->jtagOwner == c) {
+    conn_shift(c);
+    return 1;
+  }
+  c->state = XVC_WAIT_JTAG;
+  c->queued = true;
+  stat_add(core->stats.lock_waits, 1);
+  core->jtagQueue.push_back(c);
+  if (verbose) {
+    printf("%s: fd %d queued for the JTAG core (%zu waiting)\n", core->label.c_str(), c->fd, core->jtagQueue.size());
+  }
+  //the replies before the shift don't wait for the core
+  return conn_flush(c) ? 0 : -1;
+}
 
-    int nr_bytes = (len + 7) / 8;
-    if (((size_t)nr_bytes) * 2 > sizeof(buffer)) {
-      fprintf(stderr, "buffer size exceeded\n");
-      syslog(LOG_ERR,"buffer size exceeded\n");
-      return 1;
+//Handles and receives messages until the socket runs dry, false closes the connection
+static bool conn_service(xvc_conn * c) {
+  while (1) {
+    if (c->state == XVC_WAIT_JTAG) {
+      return conn_flush(c);
+    }
+    //everything already received
+    long size = conn_message_size(c);
+    if (size < 0) {
+      return false;
+    }
+    if (size > 0 && (size_t) size <= c->rx_end - c->rx_start) {
+      int rc = conn_message(c, size);
+      if (rc < 0) {
+	return false;
+      } else if (rc == 0) {
+	return true;
+      }
+      continue;
     }
 
-    if (sread(fd, buffer, nr_bytes * 2) != 1) {
-      fprintf(stderr, "reading data failed\n");
-      syslog(LOG_ERR,"reading data failed\n");
-      return 1;
+    //the client may be waiting on the replies before it sends more
+    if (!conn_flush(c)) {
+      return false;
+    }
+    if (conn_sending(c)) {
+      return true;
     }
-    memset(result, 0, nr_bytes);
 
+    //keep the partial message and make room for the rest of it
+    if (c->rx_start > 0 && c->in.size() - c->rx_start < 10 + vectorSize) {
+      memmove(&c->in[0], &c->in[c->rx_start], c->rx_end - c->rx_start);
+      c->rx_end -= c->rx_start;
+      c->rx_start = 0;
+    }
+    bool empty = c->rx_end == c->rx_start;
+    ssize_t r = recv(c->fd, &c->in[c->rx_end], c->in.size() - c->rx_end, 0);
+    if (r == 0) {
+      return false;
+    } else if (r < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+	return true;
+      }
+      perror("read");
+      return false;
+    }
+    if (empty) {
+      c->msg_start_ns = now_ns();
+      if (c->reply_done_ns) {
+	c->core->stats.turnaround_ns.record(c->msg_start_ns - c->reply_done_ns);
+	c->reply_done_ns = 0;
+      }
+    }
+    c->rx_end += r;
+    stat_add(c->core->stats.bytes_in, r);
+    if (c->slot >= 0) {
+      stat_add(c->core->stats.clients[c->slot].bytes_in, r);
+    }
+    size = conn_message_size(c);
+    if (size > 0 && (size_t) size > c->rx_end - c->rx_start) {
+      //more of a long vector is coming, ACK right away so the client's window keeps moving
+      int flag = 1;
+      setsockopt(c->fd, IPPROTO_TCP, TCP_QUICKACK, &flag, sizeof(flag));
+    }
+  }
+}
+
+static void conn_close(xvc_conn * c);
+
+//Hands a free core to the next queued client and runs its shift
+static void jtag_grant(xvc_core * core) {
+  while (core->jtagOwner == NULL && !core->jtagQueue.empty()) {
+    xvc_conn * c = core->jtagQueue.front();
+    core->jtagQueue.pop_front();
+    core->jtagOwner = c;
     if (verbose) {
-      printf("\tNumber of Bits  : %d\n", len);
-      syslog(LOG_ERR,"\tNumber of Bits  : %d\n", len);
-      printf("\tNumber of Bytes : %d \n", nr_bytes);
-      syslog(LOG_ERR,"\tNumber of Bytes : %d \n", nr_bytes);
-      printf("\n");
-      syslog(LOG_ERR,"\n");
-    }
-
-    int bytesLeft = nr_bytes;
-    int bitsLeft = len;
-    int byteIndex = 0;
-    int tdi, tms, tdo;
-
-    while (bytesLeft > 0) {
-      tms = 0;
-      tdi = 0;
-      tdo = 0;
-      if (bytesLeft >= 4) {
-	memcpy(&tms, &buffer[byteIndex], 4);
-	memcpy(&tdi, &buffer[byteIndex + nr_bytes], 4);
-	
-	pXVC->length_offset = 32;        
-	pXVC->tms_offset = tms;         
-	pXVC->tdi_offset = tdi;       
-	pXVC->ctrl_offset = 0x01;
-
-	/* Switch this to interrupt in next revision */
-	while (pXVC->ctrl_offset)
-	  {
-	  }
+      printf("%s: fd %d owns the JTAG core\n", core->label.c_str(), c->fd);
+    }
+    c->state = XVC_READ;
+    conn_shift(c);
+    if (conn_service(c)) {
+      conn_watch(c);
+    } else {
+      conn_close(c);
+    }
+  }
+}
 
-	tdo = pXVC->tdo_offset;
-	memcpy(&result[byteIndex], &tdo, 4);
-
-	bytesLeft -= 4;
-	bitsLeft -= 32;         
-	byteIndex += 4;
-
-	if (verbose) {
-	  printf("LEN : 0x%08x\n", 32);
-	  syslog(LOG_ERR,"LEN : 0x%08x\n", 32);
-	  printf("TMS : 0x%08x\n", tms);
-	  syslog(LOG_ERR,"TMS : 0x%08x\n", tms);
-	  printf("TDI : 0x%08x\n", tdi);
-	  syslog(LOG_ERR,"TDI : 0x%08x\n", tdi);
-	  printf("TDO : 0x%08x\n", tdo);
-	  syslog(LOG_ERR,"TDO : 0x%08x\n", tdo);
-	}
+//Takes the core from an owner that has been idle longer than the lock timeout
+static void jtag_expire(xvc_core * core) {
+  if (core->jtagOwner == NULL || core->jtagQueue.empty() || jtagLockTimeout <= 0 ||
+      conn_sending(core->jtagOwner) || ms_since(core->jtagLastShift) < jtagLockTimeout) {
+    return;
+  }
+  if (verbose) {
+    printf("%s: fd %d idle for %ld ms, releasing the JTAG core\n", core->label.c_str(), core->jtagOwner->fd, jtagLockTimeout);
+  }
+  core->jtagOwner = NULL;
+  jtag_grant(core);
+}
 
-      } else {
-	memcpy(&tms, &buffer[byteIndex], bytesLeft);
-	memcpy(&tdi, &buffer[byteIndex + nr_bytes], bytesLeft);
-          
-	pXVC->length_offset = bitsLeft;        
-	pXVC->tms_offset = tms;         
-	pXVC->tdi_offset = tdi;       
-	pXVC->ctrl_offset = 0x01;
-	//					/* Switch this to interrupt in next revision */
-	while (pXVC->ctrl_offset)
-	  {
-	  }
+//epoll timeout that wakes us up for the next lock expiry
+static int jtag_timeout(xvc_core * core) {
+  if (core->jtagOwner == NULL || core->jtagQueue.empty() || jtagLockTimeout <= 0) {
+    return -1;
+  }
+  long left = jtagLockTimeout - ms_since(core->jtagLastShift);
+  return (left > 0) ? left : 0;
+}
 
-	tdo = pXVC->tdo_offset;          
-	memcpy(&result[byteIndex], &tdo, bytesLeft);
-
-	if (verbose) {
-	  printf("LEN : 0x%08x\n", bitsLeft);
-	  syslog(LOG_ERR,"LEN : 0x%08x\n", bitsLeft);
-	  printf("TMS : 0x%08x\n", tms);
-	  syslog(LOG_ERR,"TMS : 0x%08x\n", tms);
-	  printf("TDI : 0x%08x\n", tdi);
-	  syslog(LOG_ERR,"TDI : 0x%08x\n", tdi);
-	  printf("TDO : 0x%08x\n", tdo);
-	  syslog(LOG_ERR,"TDO : 0x%08x\n", tdo);
+static void conn_open(xvc_core * core, int fd, struct sockaddr_in const & address) {
+  xvc_conn * c = new xvc_conn;
+  c->core = core;
+  c->fd = fd;
+  c->state = XVC_READ;
+  c->queued = false;
+  c->peer_closed = false;
+  c->msg_start_ns = 0;
+  c->shift_ready_ns = 0;
+  c->reply_done_ns = 0;
+  c->capture = NULL;
+  if (!capturePath.empty()) {
+    //one file per client, shifts of different clients must not be mixed
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.%d", core->port, ntohs(address.sin_port));
+    std::string path = capturePath + suffix;
+    c->capture = fopen(path.c_str(), "a");
+    if (c->capture == NULL) {
+      fprintf(stderr,"Failed to open capture file %s: %s\n",path.c_str(),strerror(errno));
+      syslog(LOG_ERR,"Failed to open capture file %s: %s\n",path.c_str(),strerror(errno));
+    }
+  }
+  stat_add(core->stats.connections, 1);
+  stat_add(core->stats.active, 1);
+  c->slot = -1;
+  for (int iSlot = 0; iSlot < CLIENT_SLOTS; iSlot++) {
+    xvc_client_stats & client = core->stats.clients[iSlot];
+    if (!client.active.load(std::memory_order_relaxed)) {
+      client.addr.store(address.sin_addr.s_addr, std::memory_order_relaxed);
+      client.port.store(ntohs(address.sin_port), std::memory_order_relaxed);
+      client.since_ns.store(now_ns(), std::memory_order_relaxed);
+      client.bytes_in.store(0, std::memory_order_relaxed);
+      client.bytes_out.store(0, std::memory_order_relaxed);
+      client.shifts.store(0, std::memory_order_relaxed);
+      client.bits.store(0, std::memory_order_relaxed);
+      client.active.store(true, std::memory_order_release);
+      c->slot = iSlot;
+      break;
+    }
+  }
+  //room for the largest shift and the start of the one after it
+  c->in.resize(2 * (10 + vectorSize));
+  c->rx_start = 0;
+  c->rx_end = 0;
+  c->out.resize(vectorSize);
+  c->out_end = 0;
+  c->iov_done = 0;
+  c->events = EPOLLIN;
+  struct epoll_event ev;
+  ev.events = c->events;
+  ev.data.ptr = c;
+  if (epoll_ctl(core->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("epoll_ctl");
+    conn_close(c);
+  }
+}
+
+static void conn_close(xvc_conn * c) {
+  if (c->fd < 0) {
+    return;
+  }
+  xvc_core * core = c->core;
+  if (verbose)
+    printf("%s: connection closed - fd %d\n", core->label.c_str(), c->fd);
+  epoll_ctl(core->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  c->fd = -1;
+  if (c->capture != NULL) {
+    fclose(c->capture);
+    c->capture = NULL;
+  }
+  core->closedConns.push_back(c);
+  stat_add(core->stats.active, -1);
+  if (c->slot >= 0) {
+    core->stats.clients[c->slot].active.store(false, std::memory_order_release);
+  }
+  for (std::deque<xvc_conn *>::iterator it = core->jtagQueue.begin(); it != core->jtagQueue.end(); ++it) {
+    if (*it == c) {
+      core->jtagQueue.erase(it);
+      break;
+    }
+  }
+  if (core->jtagOwner == c) {
+    core->jtagOwner = NULL;
+    jtag_grant(core);
+  }
+}
+
+static void stats_histogram(FILE * out, char const * name, xvc_histogram const & hist) {
+  uint64_t n = hist.total.load(std::memory_order_relaxed);
+  fprintf(out, "  %-13s count %llu mean %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+	  name, (unsigned long long) n,
+	  (unsigned long long) (n ? hist.sum.load(std::memory_order_relaxed) / n : 0),
+	  (unsigned long long) hist.percentile(0.5),
+	  (unsigned long long) hist.percentile(0.9),
+	  (unsigned long long) hist.percentile(0.99),
+	  (unsigned long long) hist.percentile(0.999),
+	  (unsigned long long) hist.max.load(std::memory_order_relaxed));
+}
+
+//Writes the counters and histograms of every core, latencies are in ns
+static void stats_report(FILE * out, std::vector<xvc_core *> const & cores) {
+  uint64_t now = now_ns();
+  for (size_t iCore = 0; iCore < cores.size(); iCore++) {
+    xvc_core const * core = cores[iCore];
+    xvc_stats const & stats = core->stats;
+    uint64_t bits = stats.bits.load(std::memory_order_relaxed);
+    uint64_t jtagNs = stats.jtag_ns.sum.load(std::memory_order_relaxed);
+    fprintf(out, "core %s port %d cpu %d\n", core->label.c_str(), core->port, core->cpu);
+    fprintf(out, "  connections %llu active %llu getinfo %llu settck %llu shifts %llu words %llu bits %llu\n",
+	    (unsigned long long) stats.connections.load(std::memory_order_relaxed),
+	    (unsigned long long) stats.active.load(std::memory_order_relaxed),
+	    (unsigned long long) stats.getinfos.load(std::memory_order_relaxed),
+	    (unsigned long long) stats.settcks.load(std::memory_order_relaxed),
+	    (unsigned long long) stats.shifts.load(std::memory_order_relaxed),
+	    (unsigned long long) stats.words.load(std::memory_order_relaxed),
+	    (unsigned long long) bits);
+    fprintf(out, "  bytes_in %llu bytes_out %llu lock_waits %llu jtag_bits_per_s %.0f\n",
+	    (unsigned long long) stats.bytes_in.load(std::memory_order_relaxed),
+	    (unsigned long long) stats.bytes_out.load(std::memory_order_relaxed),
+	    (unsigned long long) stats.lock_waits.load(std::memory_order_relaxed),
+	    jtagNs ? 1E9 * bits / jtagNs : 0.0);
+    stats_histogram(out, "shift_ns", stats.shift_ns);
+    stats_histogram(out, "jtag_ns", stats.jtag_ns);
+    stats_histogram(out, "go_ns", stats.go_ns);
+    stats_histogram(out, "receive_ns", stats.receive_ns);
+    stats_histogram(out, "turnaround_ns", stats.turnaround_ns);
+    stats_histogram(out, "lock_ns", stats.lock_ns);
+    for (int iSlot = 0; iSlot < CLIENT_SLOTS; iSlot++) {
+      xvc_client_stats const & client = stats.clients[iSlot];
+      if (!client.active.load(std::memory_order_acquire)) {
+	continue;
+      }
+      struct in_addr addr;
+      addr.s_addr = client.addr.load(std::memory_order_relaxed);
+      char addrString[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &addr, addrString, sizeof(addrString));
+      double up = 1E-9 * (now - client.since_ns.load(std::memory_order_relaxed));
+      uint64_t clientBits = client.bits.load(std::memory_order_relaxed);
+      fprintf(out, "  client %s:%u up %.1fs bytes_in %llu bytes_out %llu shifts %llu bits %llu bits_per_s %.0f\n",
+	      addrString, client.port.load(std::memory_order_relaxed), up,
+	      (unsigned long long) client.bytes_in.load(std::memory_order_relaxed),
+	      (unsigned long long) client.bytes_out.load(std::memory_order_relaxed),
+	      (unsigned long long) client.shifts.load(std::memory_order_relaxed),
+	      (unsigned long long) clientBits,
+	      (up > 0) ? clientBits / up : 0.0);
+    }
+  }
+}
+
+//Answers every connection on the stats socket with a report and rewrites the
+//stats file every interval seconds
+static void stats_loop(std::vector<xvc_core *> cores, std::string socketPath,
+		       std::string filePath, double interval) {
+  int listenFd = -1;
+  if (!socketPath.empty()) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    unlink(socketPath.c_str());
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 ||
+	bind(listenFd, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+	listen(listenFd, 5) < 0) {
+      syslog(LOG_ERR,"Failed to open stats socket %s: %s\n",socketPath.c_str(),strerror(errno));
+      if (listenFd >= 0) {
+	close(listenFd);
+	listenFd = -1;
+      }
+    }
+  }
+  if (listenFd < 0 && filePath.empty()) {
+    return;
+  }
+  std::string tmpPath = filePath + ".tmp";
+  int timeoutMs = filePath.empty() ? -1 : (int) (interval * 1000);
+  while (1) {
+    struct pollfd pfd;
+    pfd.fd = listenFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    //a negative fd is ignored, poll then only times out
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready > 0 && (pfd.revents & POLLIN)) {
+      int fd = accept(listenFd, NULL, NULL);
+      if (fd >= 0) {
+	FILE * out = fdopen(fd, "w");
+	if (out != NULL) {
+	  stats_report(out, cores);
+	  fclose(out);
+	} else {
+	  close(fd);
 	}
-	break;
       }
     }
-    if (write(fd, result, nr_bytes) != nr_bytes) {
-      perror("write");
-      return 1;
+    if (!filePath.empty()) {
+      FILE * out = fopen(tmpPath.c_str(), "w");
+      if (out != NULL) {
+	stats_report(out, cores);
+	fclose(out);
+	rename(tmpPath.c_str(), filePath.c_str());
+      }
     }
+  }
+}
+
+//Opens the listening socket and the epoll set of a core
+static int core_listen(xvc_core * core) {
+  if (core->port <= 0 || core->port > 0xFFFF) {
+    fprintf(stderr,"Bad port %d for %s.\n",core->port,core->label.c_str());
+    syslog(LOG_ERR,"Bad port %d for %s.\n",core->port,core->label.c_str());
+    return -1;
+  }
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  if (s < 0) {
+    perror("socket");
+    return -1;
+  }
+   
+  int i = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &i, sizeof i);
+
+  //accepted sockets inherit the buffer sizes, set before listen() so the
+  //window scale covers them
+  if (sockBufSize > 0) {
+    int size = sockBufSize;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  }
+
+  struct sockaddr_in address;
+  address.sin_addr.s_addr = INADDR_ANY;
+  address.sin_port = htons(core->port);
+  address.sin_family = AF_INET;
+
+  if (bind(s, (struct sockaddr*) &address, sizeof(address)) < 0) {
+    perror("bind");
+    return -1;
+  }
 
-  } while (1);
-  /* Note: Need to fix JTAG state updates, until then no exit is allowed */
+  if (listen(s, 5) < 0) {
+    perror("listen");
+    return -1;
+  }
+
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+  core->listenFd = s;
+
+  core->epfd = epoll_create1(0);
+  if (core->epfd < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+  struct epoll_event listenEvent;
+  listenEvent.events = EPOLLIN;
+  listenEvent.data.ptr = NULL; //the listening socket
+  if (epoll_ctl(core->epfd, EPOLL_CTL_ADD, s, &listenEvent) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
   return 0;
 }
 
-int main(int argc, char **argv) {
-  int i;
-  int s;
+//Finds and maps the UIO device of a core, or the register file of a simulated one,
+//and opens its listening socket
+static int core_open(xvc_core * core, bool useIRQ, uint32_t spinUsecs) {
+  if (mockCores) {
+    core->regs = axi_jtag_map_file(core->label);
+    if (core->regs == NULL) {
+      syslog(LOG_ERR,"Failed to map simulated core %s.\n",core->label.c_str());
+      return -1;
+    }
+    fprintf(stderr,"Simulated core @ %s.\n",core->label.c_str());
+    return core_listen(core);
+  }
 
-  int fdUIO = -1;
-  struct sockaddr_in address;
+  //Find UIO number
+  int uioN = label2uio(core->label);
+  if(uioN < 0){
+    fprintf(stderr,"Failed to find UIO device with label %s.\n",core->label.c_str());
+    syslog(LOG_ERR,"Failed to find UIO device with label %s.\n",core->label.c_str());
+    return -1;      
+  }
+  char uioFileName[64];
+  snprintf(uioFileName,sizeof(uioFileName),"/dev/uio%d",uioN);
     
+  fprintf(stderr,"Found %s @ %s.\n",core->label.c_str(),uioFileName);
+  syslog(LOG_ERR,"Found %s @ %s.\n",core->label.c_str(),uioFileName);
+  //Open UIO device
+  int fdUIO = open(uioFileName,O_RDWR);
+  if(fdUIO < 0){
+    fprintf(stderr,"Failed to open %s.\n",uioFileName);
+    syslog(LOG_ERR,"Failed to open %s.\n",uioFileName);
+    return -1;            
+  }
+    
+  void * regs = mmap(NULL,sizeof(axi_jtag_regs),
+		     PROT_READ|PROT_WRITE, MAP_SHARED,
+		     fdUIO, 0x0);
+  //the mapping stays valid without the fd
+  close(fdUIO);
+  if(MAP_FAILED == regs){
+    fprintf(stderr,"Failed to mmap %s.\n",uioFileName);
+    syslog(LOG_ERR,"Failed to mmap %s.\n",uioFileName);
+    return -1;            
+  }
+  core->regs = (axi_jtag_regs volatile *) regs;
+
+  if (useIRQ) {
+    core->irq.SetSpin(spinUsecs);
+    if (core->irq.Open(uioFileName) < 0) {
+      syslog(LOG_ERR,"No interrupt on %s, spinning on shifts.\n",uioFileName);
+    } else {
+      syslog(LOG_INFO,"Sleeping on the %s interrupt after %u us.\n",uioFileName,spinUsecs);
+    }
+  }
+  return core_listen(core);
+}
 
+//Serves the clients of one core
+static void core_loop(xvc_core * core) {
+  if (core->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core->cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      syslog(LOG_ERR,"%s: failed to pin to CPU %d\n",core->label.c_str(),core->cpu);
+      core->cpu = -1;
+    }
+  }
+  if (core->cpu >= 0) {
+    syslog(LOG_INFO,"%s: serving port %d on CPU %d\n",core->label.c_str(),core->port,core->cpu);
+  } else {
+    syslog(LOG_INFO,"%s: serving port %d\n",core->label.c_str(),core->port);
+  }
+
+  int const maxEvents = 64;
+  struct epoll_event events[maxEvents];
+  while (1) {
+    int nEvents = epoll_wait(core->epfd, events, maxEvents, jtag_timeout(core));
+    if (nEvents < 0) {
+      if (errno == EINTR)
+	continue;
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int iEvent = 0; iEvent < nEvents; ++iEvent) {
+      xvc_conn * c = (xvc_conn *) events[iEvent].data.ptr;
+      if (c == NULL) {
+	while (1) {
+	  struct sockaddr_in address;
+	  socklen_t nsize = sizeof(address);
+	  int newfd = accept4(core->listenFd, (struct sockaddr*) &address, &nsize, SOCK_NONBLOCK);
+	  if (newfd < 0) {
+	    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	      perror("accept");
+	    break;
+	  }
+	  //               if (verbose)
+	  printf("%s: connection accepted - fd %d\n", core->label.c_str(), newfd);
+	  printf("setting TCP_NODELAY to 1\n");
+	  int flag = 1;
+	  int optResult = setsockopt(newfd,
+				     IPPROTO_TCP,
+				     TCP_NODELAY,
+				     (char *)&flag,
+				     sizeof(int));
+	  if (optResult < 0)
+	    perror("TCP_NODELAY error");
+	  //don't hold back the ACKs of the first vector
+	  setsockopt(newfd, IPPROTO_TCP, TCP_QUICKACK, &flag, sizeof(flag));
+	  conn_open(core, newfd, address);
+	}
+	continue;
+      }
+      if (c->fd < 0) {
+	//closed earlier in this batch
+	continue;
+      }
+      if (c->state == XVC_WAIT_JTAG && (events[iEvent].events & (EPOLLERR | EPOLLHUP))) {
+	if (verbose)
+	  printf("%s: connection aborted - fd %d\n", core->label.c_str(), c->fd);
+	conn_close(c);
+	continue;
+      }
+      if (c->state == XVC_WAIT_JTAG && (events[iEvent].events & EPOLLRDHUP)) {
+	//a client may send its last shift and shut down, it still gets the
+	//TDO; the connection closes when recv() sees the end after that
+	c->peer_closed = true;
+      }
+      if (conn_service(c)) {
+	conn_watch(c);
+      } else {
+	conn_close(c);
+      }
+    }
+
+    jtag_expire(core);
+    for (size_t iConn = 0; iConn < core->closedConns.size(); iConn++) {
+      delete core->closedConns[iConn];
+    }
+    core->closedConns.clear();
+  }
+}
+
+int main(int argc, char **argv) {
   openlog("xvcServer",LOG_PERROR|LOG_PID|LOG_ODELAY,LOG_DAEMON);
   syslog(LOG_INFO,"starting %s", argv[0]);                                                                                                                                                                         
-  int port;
+  std::vector<xvc_core *> cores;
+  bool useIRQ = false;
+  uint32_t spinUsecs = 0;
+  std::string statsSocket;
+  std::string statsFile;
+  double statsInterval = 1;
    
   try {
     TCLAP::CmdLine cmd("Apollo XVC.",
@@ -251,7 +1091,7 @@ int main(int argc, char **argv) {
     TCLAP::ValueArg<std::string> xvcPreFix("v",              //one char flag
 					       "xvc",      // full flag name
 					       "xvc prefix",//description
-					       true,            //required
+					       false,            //required
 					       std::string(""),  //Default is empty
 					       "string",         // type
 					       cmd);
@@ -260,48 +1100,158 @@ int main(int argc, char **argv) {
     TCLAP::ValueArg<int> xvcPort("p",              //one char flag
 				 "port",      // full flag name
 				 "xvc port number",//description
-				 true,            //required
+				 false,            //required
 				 -1,  //Default is empty
 				 "int",         // type
 				 cmd);
 
+    // several cores in one process
+    TCLAP::MultiArg<std::string> xvcCores("c",              //one char flag
+					  "core",      // full flag name
+					  "label:port[:cpu] of a JTAG core, repeat for more cores. Each core gets a thread, pinned round robin unless cpu is given",//description
+					  false,            //required
+					  "label:port[:cpu]",         // type
+					  cmd);
+
+    // largest shift vector
+    TCLAP::ValueArg<size_t> xvcVectorSize("s",              //one char flag
+					  "size",      // full flag name
+					  "max shift vector size in bytes (TMS+TDI) reported to clients",//description
+					  false,            //required
+					  DEFAULT_VECTOR_SIZE,  //Default
+					  "bytes",         // type
+					  cmd);
+
+    // JTAG lock timeout
+    TCLAP::ValueArg<long> xvcLockTimeout("t",              //one char flag
+					 "lock-timeout",      // full flag name
+					 "ms a client may sit idle on the JTAG core before a waiting client gets it, 0 holds it until disconnect",//description
+					 false,            //required
+					 0,  //Default
+					 "ms",         // type
+					 cmd);
+
+    // interrupt driven completion
+    TCLAP::SwitchArg xvcIRQ("i",              //one char flag
+			    "irq",      // full flag name
+			    "sleep on the UIO interrupt of the JTAG core instead of spinning on long shifts",//description
+			    cmd,
+			    false);
+    TCLAP::ValueArg<uint32_t> xvcSpin("w",              //one char flag
+				      "spin",      // full flag name
+				      "us to spin on a shift before sleeping on the interrupt",//description
+				      false,            //required
+				      50,  //Default
+				      "us",         // type
+				      cmd);
+
+    // simulated cores
+    TCLAP::SwitchArg xvcMock("",              //one char flag
+			     "mock",      // full flag name
+			     "the labels are jtagSim register files, for testing without hardware",//description
+			     cmd,
+			     false);
+
+    // statistics
+    TCLAP::ValueArg<std::string> xvcStatsSocket("",              //one char flag
+						"stats-socket",      // full flag name
+						"UNIX socket that answers every connection with the counters and latency histograms",//description
+						false,            //required
+						std::string(""),  //Default is empty
+						"path",         // type
+						cmd);
+    TCLAP::ValueArg<std::string> xvcStatsFile("",              //one char flag
+					      "stats-file",      // full flag name
+					      "file rewritten with the counters and latency histograms",//description
+					      false,            //required
+					      std::string(""),  //Default is empty
+					      "path",         // type
+					      cmd);
+    // traffic capture
+    TCLAP::ValueArg<std::string> xvcCapture("",              //one char flag
+					    "capture",      // full flag name
+					    "append the messages each client sends to <path>.<port>.<client port> for xvcReplay",//description
+					    false,            //required
+					    std::string(""),  //Default is empty
+					    "path",         // type
+					    cmd);
+    // socket buffers
+    TCLAP::ValueArg<int> xvcSockBuf("b",              //one char flag
+				    "sockbuf",      // full flag name
+				    "client socket send/receive buffer size in bytes, by default big enough for two of the largest shifts, 0 for the kernel's",//description
+				    false,            //required
+				    -1,  //Default
+				    "bytes",         // type
+				    cmd);
+    TCLAP::ValueArg<double> xvcStatsInterval("",              //one char flag
+					     "stats-interval",      // full flag name
+					     "seconds between stats file updates",//description
+					     false,            //required
+					     1.0,  //Default
+					     "s",         // type
+					     cmd);
   
     //Parse the command line arguments
     cmd.parse(argc,argv);
-    port = xvcPort.getValue();
-
-    //Find UIO number
-    int uioN = label2uio(xvcPreFix.getValue());
-    if(uioN < 0){
-      fprintf(stderr,"Failed to find UIO device with label %s.\n",xvcPreFix.getValue().c_str());
-      syslog(LOG_ERR,"Failed to find UIO device with label %s.\n",xvcPreFix.getValue().c_str());
-      return 1;      
-    }
-    size_t const uioFileNameLength = 1024;
-    char * uioFileName = new char[uioFileNameLength+1];
-    memset(uioFileName,0x0,uioFileNameLength+1);
-    snprintf(uioFileName,uioFileNameLength,"/dev/uio%d",uioN);
-    
-    fprintf(stderr,"Found %s @ %s.\n",xvcPreFix.getValue().c_str(),uioFileName);
-    syslog(LOG_ERR,"Found %s @ %s.\n",xvcPreFix.getValue().c_str(),uioFileName);
-    //Open UIO device
-    fdUIO = open(uioFileName,O_RDWR);
-    if(fdUIO < 0){
-      fprintf(stderr,"Failed to open %s.\n",uioFileName);
-      syslog(LOG_ERR,"Failed to open %s.\n",uioFileName);
-      return 1;            
+    statsSocket = xvcStatsSocket.getValue();
+    statsFile = xvcStatsFile.getValue();
+    statsInterval = xvcStatsInterval.getValue();
+    if (statsInterval < 0.01) {
+      statsInterval = 0.01;
     }
-    
-    pXVC = (sXVC volatile*) mmap(NULL,sizeof(sXVC),
-				 PROT_READ|PROT_WRITE, MAP_SHARED,
-				 fdUIO, 0x0);
-    if(MAP_FAILED == pXVC){
-      fprintf(stderr,"Failed to mmap %s.\n",uioFileName);
-      syslog(LOG_ERR,"Failed to mmap %s.\n",uioFileName);
-      return 1;            
+    statsEnabled = !statsSocket.empty() || !statsFile.empty();
+    capturePath = xvcCapture.getValue();
+    jtagLockTimeout = xvcLockTimeout.getValue();
+    useIRQ = xvcIRQ.getValue();
+    mockCores = xvcMock.getValue();
+    spinUsecs = xvcSpin.getValue();
+
+    //Shift buffers, TMS and TDI take half each so the size is kept even
+    vectorSize = xvcVectorSize.getValue() & ~((size_t) 0x1);
+    if (vectorSize < MIN_VECTOR_SIZE || vectorSize > MAX_VECTOR_SIZE) {
+      fprintf(stderr,"Vector size must be between %d and %d bytes.\n",MIN_VECTOR_SIZE,MAX_VECTOR_SIZE);
+      syslog(LOG_ERR,"Vector size must be between %d and %d bytes.\n",MIN_VECTOR_SIZE,MAX_VECTOR_SIZE);
+      return 1;
+    }
+    snprintf(xvcInfo,sizeof(xvcInfo),"xvcServer_v1.0:%zu\n",vectorSize);
+    syslog(LOG_INFO,"max vector size %zu bytes\n",vectorSize);
+    sockBufSize = xvcSockBuf.getValue();
+    if (sockBufSize < 0) {
+      sockBufSize = 2 * (10 + vectorSize);
     }
 
-    
+    //the cores to serve
+    long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    std::vector<std::string> coreArgs = xvcCores.getValue();
+    for (size_t iCore = 0; iCore < coreArgs.size(); iCore++) {
+      size_t colon = coreArgs[iCore].find(':');
+      int port = -1;
+      int cpu = (nCPUs > 0) ? iCore % nCPUs : -1;
+      if (colon == std::string::npos || colon == 0 ||
+	  sscanf(coreArgs[iCore].c_str() + colon + 1, "%d:%d", &port, &cpu) < 1) {
+	fprintf(stderr,"Bad core %s, expected label:port[:cpu].\n",coreArgs[iCore].c_str());
+	syslog(LOG_ERR,"Bad core %s, expected label:port[:cpu].\n",coreArgs[iCore].c_str());
+	return 1;
+      }
+      xvc_core * core = new xvc_core;
+      core->label = coreArgs[iCore].substr(0, colon);
+      core->port = port;
+      core->cpu = cpu;
+      cores.push_back(core);
+    }
+    if (!xvcPreFix.getValue().empty()) {
+      //a single core isn't pinned
+      xvc_core * core = new xvc_core;
+      core->label = xvcPreFix.getValue();
+      core->port = xvcPort.getValue();
+      core->cpu = -1;
+      cores.push_back(core);
+    }
+    if (cores.empty()) {
+      fprintf(stderr,"No JTAG core given, use --xvc and --port or --core.\n");
+      syslog(LOG_ERR,"No JTAG core given, use --xvc and --port or --core.\n");
+      return 1;
+    }
   }catch (TCLAP::ArgException &e) {
     fprintf(stderr, "Error %s for arg %s\n",
 	    e.error().c_str(), e.argId().c_str());
@@ -311,92 +1261,28 @@ int main(int argc, char **argv) {
   }
 
   opterr = 0;
-  s = socket(AF_INET, SOCK_STREAM, 0);
-               
-  if (s < 0) {
-    perror("socket");
-    return 1;
+  for (size_t iCore = 0; iCore < cores.size(); iCore++) {
+    xvc_core * core = cores[iCore];
+    core->regs = NULL;
+    core->listenFd = -1;
+    core->epfd = -1;
+    core->jtagOwner = NULL;
+    if (core_open(core, useIRQ, spinUsecs) < 0) {
+      return 1;
+    }
   }
-   
-  i = 1;
-  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &i, sizeof i);
-
-  address.sin_addr.s_addr = INADDR_ANY;
-  address.sin_port = htons(port);
-  address.sin_family = AF_INET;
 
-  if (bind(s, (struct sockaddr*) &address, sizeof(address)) < 0) {
-    perror("bind");
-    return 1;
+  //a thread per core, the last one runs on the main thread
+  std::vector<std::thread> threads;
+  if (statsEnabled) {
+    std::thread(stats_loop, cores, statsSocket, statsFile, statsInterval).detach();
   }
-
-  if (listen(s, 5) < 0) {
-    perror("listen");
-    return 1;
+  for (size_t iCore = 0; iCore + 1 < cores.size(); iCore++) {
+    threads.push_back(std::thread(core_loop, cores[iCore]));
+  }
+  core_loop(cores.back());
+  for (size_t iThread = 0; iThread < threads.size(); iThread++) {
+    threads[iThread].join();
   }
-
-  fd_set conn;
-  int maxfd = 0;
-
-  FD_ZERO(&conn);
-  FD_SET(s, &conn);
-
-  maxfd = s;
-
-  while (1) {
-    fd_set read = conn, except = conn;
-    int fd;
-
-    if (select(maxfd + 1, &read, 0, &except, 0) < 0) {
-      perror("select");
-      break;
-    }
-
-    for (fd = 0; fd <= maxfd; ++fd) {
-      if (FD_ISSET(fd, &read)) {
-	if (fd == s) {
-	  int newfd;
-	  socklen_t nsize = sizeof(address);
-
-	  newfd = accept(s, (struct sockaddr*) &address, &nsize);
-
-	  //               if (verbose)
-	  printf("connection accepted - fd %d\n", newfd);
-	  if (newfd < 0) {
-	    perror("accept");
-	  } else {
-	    printf("setting TCP_NODELAY to 1\n");
-	    int flag = 1;
-	    int optResult = setsockopt(newfd,
-				       IPPROTO_TCP,
-				       TCP_NODELAY,
-				       (char *)&flag,
-				       sizeof(int));
-	    if (optResult < 0)
-	      perror("TCP_NODELAY error");
-	    if (newfd > maxfd) {
-	      maxfd = newfd;
-	    }
-	    FD_SET(newfd, &conn);
-	  }
-	}
-	else if (handle_data(fd)) {
-
-	  if (verbose)
-	    printf("connection closed - fd %d\n", fd);
-	  close(fd);
-	  FD_CLR(fd, &conn);
-	}
-      }
-      else if (FD_ISSET(fd, &except)) {
-	if (verbose)
-	  printf("connection aborted - fd %d\n", fd);
-	close(fd);
-	FD_CLR(fd, &conn);
-	if (fd == s)
-	  break;
-      }
-    }
-  }  
   return 0;
 }